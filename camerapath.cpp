@@ -0,0 +1,118 @@
+#include "camerapath.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+bool loadCameraPath(const char* path, CameraPath& cameraPath, std::string& error) {
+    cameraPath.scene = "drop";
+    cameraPath.particles = 1000;
+    cameraPath.seed = 65;
+    cameraPath.framesPerSecond = 30;
+    cameraPath.stepsPerFrame = 1;
+    cameraPath.deltaTime = 0.03f;
+    cameraPath.deterministic = true;
+    cameraPath.motionBlur = 1;
+    cameraPath.keys.clear();
+
+    std::ifstream file(path);
+    if (!file) {
+        error = std::string("can't open ") + path;
+        return false;
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream words(line);
+        std::string directive;
+        if (!(words >> directive)) continue;
+
+        bool valid;
+        if (directive == "scene") valid = (bool)(words >> cameraPath.scene);
+        else if (directive == "particles") valid = (words >> cameraPath.particles) && cameraPath.particles >= 0;
+        else if (directive == "seed") valid = (bool)(words >> cameraPath.seed);
+        else if (directive == "fps") valid = (words >> cameraPath.framesPerSecond) && cameraPath.framesPerSecond > 0;
+        else if (directive == "steps") valid = (words >> cameraPath.stepsPerFrame) && cameraPath.stepsPerFrame > 0;
+        else if (directive == "dt") valid = (words >> cameraPath.deltaTime) && cameraPath.deltaTime > 0.0f;
+        else if (directive == "deterministic") valid = (bool)(words >> cameraPath.deterministic);
+        else if (directive == "blur") valid = (words >> cameraPath.motionBlur) && cameraPath.motionBlur > 0;
+        else if (directive == "key") {
+            CameraKey key;
+            valid = (bool)(words >> key.time >> key.position.x >> key.position.y >> key.position.z
+                                 >> key.target.x >> key.target.y >> key.target.z >> key.fovy);
+            if (valid) cameraPath.keys.push_back(key);
+        } else {
+            valid = false;
+        }
+
+        std::string extra;
+        if (!valid || (words >> extra)) {
+            error = std::string(path) + ":" + std::to_string(number) + ": can't read '" + line + "'";
+            return false;
+        }
+    }
+
+    if (cameraPath.keys.empty()) {
+        error = std::string(path) + ": no camera keys";
+        return false;
+    }
+    std::stable_sort(cameraPath.keys.begin(), cameraPath.keys.end(), [](const CameraKey& a, const CameraKey& b) { return a.time < b.time; });
+    return true;
+}
+
+// cubic Hermite basis on s in [0, 1] with tangents already scaled to the segment
+static inline float hermite(float p0, float p1, float m0, float m1, float s) {
+    const float s2 = s*s, s3 = s2*s;
+    return (2*s3 - 3*s2 + 1)*p0 + (s3 - 2*s2 + s)*m0 + (-2*s3 + 3*s2)*p1 + (s3 - s2)*m1;
+}
+
+// key k's values as one array, so every channel is interpolated the same way
+static inline void keyValues(const CameraKey& key, float values[7]) {
+    values[0] = key.position.x; values[1] = key.position.y; values[2] = key.position.z;
+    values[3] = key.target.x; values[4] = key.target.y; values[5] = key.target.z;
+    values[6] = key.fovy;
+}
+
+// Catmull-Rom tangent at key k, per unit time; one-sided at the ends
+static inline void keyTangent(const std::vector<CameraKey>& keys, int k, float tangent[7]) {
+    const int last = (int)keys.size() - 1;
+    const int before = k > 0 ? k - 1 : k, after = k < last ? k + 1 : k;
+    const float span = keys[after].time - keys[before].time;
+    float a[7], b[7];
+    keyValues(keys[before], a);
+    keyValues(keys[after], b);
+    for (int c = 0; c < 7; c++) tangent[c] = span > 0.0f ? (b[c] - a[c])/span : 0.0f;
+}
+
+void evaluateCameraPath(const CameraPath& cameraPath, float time, Vector3* position, Vector3* target, float* fovy) {
+    const std::vector<CameraKey>& keys = cameraPath.keys;
+    float values[7];
+    if (keys.empty()) {
+        CameraKey origin = {0.0f, Vector3Zero(), Vector3Zero(), 45.0f};
+        keyValues(origin, values);
+    } else if (time <= keys.front().time || keys.size() == 1) {
+        keyValues(keys.front(), values);
+    } else if (time >= keys.back().time) {
+        keyValues(keys.back(), values);
+    } else {
+        int k = 0;
+        while (keys[k + 1].time <= time) k++;
+        const float span = keys[k + 1].time - keys[k].time;
+        const float s = (time - keys[k].time)/span;
+        float p0[7], p1[7], m0[7], m1[7];
+        keyValues(keys[k], p0);
+        keyValues(keys[k + 1], p1);
+        keyTangent(keys, k, m0);
+        keyTangent(keys, k + 1, m1);
+        for (int c = 0; c < 7; c++) values[c] = hermite(p0[c], p1[c], m0[c]*span, m1[c]*span, s);
+    }
+    *position = {values[0], values[1], values[2]};
+    *target = {values[3], values[4], values[5]};
+    *fovy = values[6];
+}
+
+float cameraPathDuration(const CameraPath& cameraPath) {
+    return cameraPath.keys.empty() ? 0.0f : cameraPath.keys.back().time;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <raymath.h>
+#include <string>
+#include <vector>
+
+struct CameraKey {
+    float time;         // seconds of output video
+    Vector3 position;
+    Vector3 target;
+    float fovy;         // degrees
+};
+
+// a scripted shot: the scene it plays in, and the camera keyframes through it.
+// Everything that decides a frame is in here, so any machine renders the same frames.
+struct CameraPath {
+    std::string scene;
+    int particles;
+    unsigned int seed;
+    int framesPerSecond;
+    int stepsPerFrame;
+    float deltaTime;
+    bool deterministic;             // run the solver in deterministicMode, on by default
+    int motionBlur;                 // sub-frames averaged into each frame, 1 for none
+    std::vector<CameraKey> keys;    // sorted by time
+};
+
+// text file, one directive per line, # starts a comment:
+//   scene drop | particles 1000 | seed 65 | fps 30 | steps 1 | dt 0.03 | deterministic 1 | blur 1
+//   key <time> <position x y z> <target x y z> <fovy>
+// Returns false, with a message in error, if the file can't be read or a line is malformed.
+bool loadCameraPath(const char* path, CameraPath& cameraPath, std::string& error);
+
+// position, target and fovy at time, on a Catmull-Rom spline through the keys
+// (tangents from the neighboring keys, weighted by their spacing in time);
+// held at the first and last key outside their range
+void evaluateCameraPath(const CameraPath& cameraPath, float time, Vector3* position, Vector3* target, float* fovy);
+
+// time of the last key
+float cameraPathDuration(const CameraPath& cameraPath);
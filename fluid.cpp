@@ -0,0 +1,1035 @@
+// references: https://matthias-research.github.io/pages/publications/sca03.pdf
+
+#include "fluid.h"
+
+#include "forcefields.h"
+#include "probes.h"
+#include "rigidbody.h"
+#include "secondary.h"
+#include "taskgraph.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+std::vector<Particle> particles;
+
+float sphereSize = 40.0;
+
+float sampleRadius = 12.0f;
+
+float restDensity = 0.0001f;
+
+float gasConstant = 100.0f;
+
+float viscosity = 0.01f;
+
+float surfaceTension = 50.0f;
+
+float gravity = 0.1f;
+
+Diagnostics diagnostics = {};
+DriftAlarm driftAlarm = { DRIFT_LOG, 0.0, 0.0 };
+
+static bool hasReference = false;
+static Diagnostics reference;
+static double referenceMass = 0.0;
+static bool energyAlarmRaised = false;
+static bool momentumAlarmRaised = false;
+
+BlowupGuard blowupGuard = { true, 4 };
+int blowupCount = 0;
+
+static std::vector<Particle> rollbackState;
+static std::vector<RigidBody> rollbackBodies;
+
+UniformGrid particleGrid;
+SparseGrid sparseParticleGrid;
+NeighborList particleNeighbors;
+
+bool incrementalGrid = false;
+int gridSlack = 4;
+float gridRebuildFraction = 0.5f;
+
+// particleGrid matches the particles except for the cell changes recorded in
+// cellMovers by the last integration pass, one list per thread
+static bool gridCurrent = false;
+static float gridRadius = 0.0f;
+static bool trackingCells = false;
+static std::vector<std::vector<int> > cellMovers;
+static std::vector<int> movers;
+
+// how far any particle can have moved since the grids were built or updated,
+// infinite when they may not match the particles at all
+static float gridDrift = INFINITY;
+static UniformGrid queryGrid;
+
+// particleGrid was built or updated for this step; brute force and the sparse
+// search leave it alone unless tiles or cell tracking need it
+static bool denseGridBuilt = false;
+
+NeighborSearch neighborSearch = NEIGHBOR_SEARCH_AUTO;
+int bruteForceMaxParticles = 8192;
+int autoSearchInterval = 200;
+
+static NeighborSearch autoChoice = NEIGHBOR_SEARCH_GRID;
+static NeighborSearch lastSearch = NEIGHBOR_SEARCH_GRID;
+static int autoChoiceCount = -1;
+static int stepsSinceAutoChoice = 0;
+
+bool deterministicMode = false;
+int fixedPointBits = 16;
+
+// units of the integer neighbor sums in deterministic mode, powers of two
+// chosen each step from bounds on the terms so that no sum can overflow
+static struct {
+    double density, colorGradient, colorDivergence, colorSupport, pressureForce, viscosityForce;
+    double interfaceGradient, interfaceLaplacian;
+} fixedUnit;
+
+StepScheduler stepScheduler = SCHEDULER_PASSES;
+int cellsPerTile = 1;
+
+static TileSet particleTiles;
+static TaskGraph stepGraph;
+
+// gravity plus forceFields at each particle, from one batched pass per step
+static std::vector<Vector3> externalAcceleration;
+
+std::vector<FluidPhase> fluidPhases;
+
+// the table used by this step, and the symmetric pair tensions derived from it
+static std::vector<FluidPhase> activePhases;
+static float pairTension[maxFluidPhases][maxFluidPhases];
+static bool multiPhase = false;
+
+// interface color field, where a neighbor of another phase counts with the
+// pair's interface tension; only filled in when there is more than one phase
+static std::vector<Vector3> interfaceGradient;
+static std::vector<float> interfaceLaplacian;
+
+// rigid body surface samples in world space, rebuilt every step, and for each
+// fluid particle the samples within sampleRadius
+static std::vector<Vector3> boundaryPositions;
+static std::vector<Vector3> boundaryVelocities;
+static std::vector<float> boundaryVolumes;
+static std::vector<int> boundaryBody;
+static UniformGrid boundaryGrid;
+static NeighborList boundaryNeighbors;
+static bool coupled = false;
+
+// a sample counts as fluid of this density (the previous step's mean) times its volume
+static float boundaryDensity = 0.0f;
+
+// reaction on each body from the force pass, one row of bodies per thread
+static int bodyThreads = 1;
+static std::vector<Vector3> threadBodyForce;
+static std::vector<Vector3> threadBodyTorque;
+
+static struct {
+    float h, h2;
+    float poly6;        // 315/(64*pi*h^9)
+    float spiky;        // 15/(pi*h^6)
+    float viscosity;    // 45/(pi*h^6)
+} kernel;
+
+float W_poly6(Vector3 r, float h) {
+    float magnitude = Vector3Length(r);
+    if (0 <= magnitude && magnitude <= h) {
+        return (315.f/(64.f*PI*powf(h, 9.f)))*powf(h*h - magnitude*magnitude, 3.f);
+    } else {
+        return 0.f;
+    }
+}
+
+float W_poly6_Gradient(Vector3 r, float h) {
+    float magnitude = Vector3Length(r);
+    if (0 <= magnitude && magnitude <= h) {
+        return (315.f/(64.f*PI*powf(h, 9.f)))*(-2.f*magnitude)*3.f*powf(h*h - magnitude*magnitude, 2.f);
+    } else {
+        return 0.f;
+    }
+}
+
+float W_poly6_Laplacian(Vector3 r, float h) {
+    float magnitude = Vector3Length(r);
+    if (0 <= magnitude && magnitude <= h) {
+        return (315.f/(64.f*PI*powf(h, 9.f)))*6.f*(h*h - magnitude*magnitude)*(5*magnitude*magnitude - h*h);
+    } else {
+        return 0.f;
+    }
+}
+
+
+float W_viscosity_Laplacian(Vector3 r, float h) {
+    float magnitude = Vector3Length(r);
+    if (0 <= magnitude && magnitude <= h) {
+        return (45.f/(PI*powf(h, 6.f)))*(h - magnitude);
+    } else {
+        return 0.f;
+    }
+}
+
+float W_spiky(Vector3 r, float h) {
+    float magnitude = Vector3Length(r);
+    if (0 <= magnitude && magnitude <= h) {
+        return (15.f/(PI*powf(h, 6.f)))*powf(h - magnitude, 3.f);
+    } else {
+        return 0.f;
+    }
+}
+
+float W_spiky_Gradient(Vector3 r, float h) {
+    float magnitude = Vector3Length(r);
+    if (0 <= magnitude && magnitude <= h) {
+        return (15.f/(PI*powf(h, 6.f)))*(-1.f)*3.f*powf(h - magnitude, 2.f);
+    } else {
+        return 0.f;
+    }
+}
+
+// the neighbor list only holds pairs with 0 <= |r| <= h, so these skip the range
+// check of the W_* functions above and take |r|^2 where that avoids a sqrt
+static inline float poly6(float r2) {
+    float d = kernel.h2 - r2;
+    return kernel.poly6*d*d*d;
+}
+
+// W_poly6_Gradient(r)*normalize(r) without the division: the gradient carries a factor |r|
+static inline float poly6GradientOverR(float r2) {
+    float d = kernel.h2 - r2;
+    return kernel.poly6*(-6.f)*d*d;
+}
+
+static inline float poly6Laplacian(float r2) {
+    return kernel.poly6*6.f*(kernel.h2 - r2)*(5*r2 - kernel.h2);
+}
+
+static inline float viscosityLaplacian(float magnitude) {
+    return kernel.viscosity*(kernel.h - magnitude);
+}
+
+static inline float spikyGradient(float magnitude) {
+    float d = kernel.h - magnitude;
+    return kernel.spiky*(-1.f)*3.f*d*d;
+}
+
+// a particle's own contribution, which the neighbor list leaves out
+static inline float poly6AtZero() {
+    return kernel.poly6*kernel.h2*kernel.h2*kernel.h2;
+}
+
+// powf is up to the C library; a product of floats is the same everywhere
+static float power(float x, int n) {
+    float result = 1.0f;
+    for (int k = 0; k < n; k++) result *= x;
+    return result;
+}
+
+static void updateKernelConstants() {
+    const float h = sampleRadius;
+    const float h6 = deterministicMode ? power(h, 6) : powf(h, 6.f);
+    const float h9 = deterministicMode ? power(h, 9) : powf(h, 9.f);
+    kernel.h = h;
+    kernel.h2 = h*h;
+    kernel.poly6 = 315.f/(64.f*PI*h9);
+    kernel.spiky = 15.f/(PI*h6);
+    kernel.viscosity = 45.f/(PI*h6);
+}
+
+// neighbor sums: in float, in neighbor order, or in deterministic mode in integer
+// steps of a fixedUnit, which wrap modulo 2^64 and so come out the same in any order
+template <bool Fixed> struct Sum;
+
+template <> struct Sum<false> {
+    float value;
+    explicit Sum(double) : value(0.0f) {}
+    void add(float term) { value += term; }
+    float get() const { return value; }
+};
+
+template <> struct Sum<true> {
+    unsigned long long value;
+    float poison;       // term - term, so a non-finite term still makes the sum NaN
+    double unit;
+    explicit Sum(double unit) : value(0), poison(0.0f), unit(unit) {}
+    void add(float term) {
+        value += (unsigned long long)llrint(term/unit);
+        poison += term - term;
+    }
+    float get() const { return (float)((long long)value*unit) + poison; }
+};
+
+template <bool Fixed> struct Sum3 {
+    Sum<Fixed> x, y, z;
+    explicit Sum3(double unit) : x(unit), y(unit), z(unit) {}
+    void add(Vector3 term) { x.add(term.x); y.add(term.y); z.add(term.z); }
+    Vector3 get() const { return {x.get(), y.get(), z.get()}; }
+};
+
+template <bool Fixed>
+static float sumDensity(int i) {
+    const Particle& particle = particles[i];
+    Sum<Fixed> density(fixedUnit.density);
+    density.add(particle.mass*poly6AtZero());
+    for (int k = particleNeighbors.start[i]; k < particleNeighbors.start[i + 1]; k++) {
+        const Particle& other = particles[particleNeighbors.index[k]];
+        density.add(other.mass*poly6(Vector3DistanceSqr(particle.position, other.position)));
+    }
+    if (coupled) {
+        for (int k = boundaryNeighbors.start[i]; k < boundaryNeighbors.start[i + 1]; k++) {
+            const int b = boundaryNeighbors.index[k];
+            density.add(boundaryDensity*boundaryVolumes[b]*poly6(Vector3DistanceSqr(particle.position, boundaryPositions[b])));
+        }
+    }
+    return density.get();
+}
+
+float sampleDensity(int i) {
+    return deterministicMode ? sumDensity<true>(i) : sumDensity<false>(i);
+}
+
+float samplePressure(int i) {
+    float pressure = gasConstant*(particles[i].density - activePhases[particles[i].phase].restDensity);
+    return pressure;
+}
+
+float sampleColor(int i) {
+    const Particle& particle = particles[i];
+    float color = particle.mass*(1.0f/particle.density)*poly6AtZero();
+    for (int k = particleNeighbors.start[i]; k < particleNeighbors.start[i + 1]; k++) {
+        const Particle& other = particles[particleNeighbors.index[k]];
+        color += other.mass*(1.0f/other.density)*poly6(Vector3DistanceSqr(particle.position, other.position));
+    }
+    return color;
+}
+
+template <bool Fixed>
+static Vector3 sumColorGradient(int i) {
+    const Particle& particle = particles[i];
+    Sum3<Fixed> colorGradient(fixedUnit.colorGradient);
+    for (int k = particleNeighbors.start[i]; k < particleNeighbors.start[i + 1]; k++) {
+        const Particle& other = particles[particleNeighbors.index[k]];
+        Vector3 r = Vector3Subtract(other.position, particle.position);
+        colorGradient.add(Vector3Scale(r, other.mass*(1.0f/other.density)*poly6GradientOverR(Vector3LengthSqr(r))));
+    }
+    return colorGradient.get();
+}
+
+Vector3 sampleColorGradient(int i) {
+    return deterministicMode ? sumColorGradient<true>(i) : sumColorGradient<false>(i);
+}
+
+// a color gradient shorter than this over h is interior noise, its direction meaningless
+static const float surfaceNormalLimit = 0.3f;
+
+// divergence of the unit surface normal over the neighbors that have one, divided by
+// the divergence of x over the same neighbors (3 with full support, Morris 2000) so
+// the support cut off at the surface still gives the curvature
+template <bool Fixed>
+static float sumColorDivergence(int i) {
+    const Particle& particle = particles[i];
+    const float limit2 = surfaceNormalLimit*surfaceNormalLimit/kernel.h2;
+    if (Vector3LengthSqr(particle.colorGradient) < limit2) return 0.0f;
+    const Vector3 normal = Vector3Normalize(particle.colorGradient);
+    Sum<Fixed> colorDivergence(fixedUnit.colorDivergence);
+    Sum<Fixed> support(fixedUnit.colorSupport);
+    for (int k = particleNeighbors.start[i]; k < particleNeighbors.start[i + 1]; k++) {
+        const Particle& other = particles[particleNeighbors.index[k]];
+        if (Vector3LengthSqr(other.colorGradient) < limit2) continue;
+        Vector3 r = Vector3Subtract(particle.position, other.position);
+        float weight = other.mass*(1.0f/other.density)*poly6GradientOverR(Vector3LengthSqr(r));
+        colorDivergence.add(weight*Vector3DotProduct(Vector3Subtract(Vector3Normalize(other.colorGradient), normal), r));
+        support.add(-weight*Vector3LengthSqr(r));
+    }
+    const float divergence = colorDivergence.get(), volume = support.get();
+    return volume > 0.0f ? 3.0f*divergence/volume : 0.0f;
+}
+
+float sampleColorDivergence(int i) {
+    return deterministicMode ? sumColorDivergence<true>(i) : sumColorDivergence<false>(i);
+}
+
+template <bool Fixed>
+static Vector3 sumPressureForce(int i) {
+    const Particle& particle = particles[i];
+    Sum3<Fixed> pressureForce(fixedUnit.pressureForce);
+    for (int k = particleNeighbors.start[i]; k < particleNeighbors.start[i + 1]; k++) {
+        const Particle& other = particles[particleNeighbors.index[k]];
+        Vector3 r = Vector3Subtract(particle.position, other.position);
+        float magnitude = Vector3Length(r);
+        // coincident particles push nowhere, as Vector3Normalize would give
+        float inverseMagnitude = magnitude > 0.0f ? 1.0f/magnitude : 0.0f;
+        pressureForce.add(Vector3Negate(Vector3Scale(r, inverseMagnitude*other.mass*(particle.pressure + other.pressure)/(2.0f*other.density)*spikyGradient(magnitude))));
+    }
+    return pressureForce.get();
+}
+
+Vector3 samplePressureForce(int i) {
+    return deterministicMode ? sumPressureForce<true>(i) : sumPressureForce<false>(i);
+}
+
+template <bool Fixed>
+static Vector3 sumViscosityForce(int i) {
+    const Particle& particle = particles[i];
+    const float ownViscosity = activePhases[particle.phase].viscosity;
+    Sum3<Fixed> viscosityForce(fixedUnit.viscosityForce);
+    for (int k = particleNeighbors.start[i]; k < particleNeighbors.start[i + 1]; k++) {
+        const Particle& other = particles[particleNeighbors.index[k]];
+        float magnitude = Vector3Distance(particle.position, other.position);
+        float pairViscosity = 0.5f*(ownViscosity + activePhases[other.phase].viscosity);
+        viscosityForce.add(Vector3Scale(Vector3Subtract(other.velocity, particle.velocity), pairViscosity*other.mass*(1.f/other.density)*viscosityLaplacian(magnitude)));
+    }
+    return viscosityForce.get();
+}
+
+Vector3 sampleViscosityForce(int i) {
+    return deterministicMode ? sumViscosityForce<true>(i) : sumViscosityForce<false>(i);
+}
+
+// -sigma*kappa*grad(c) with colorGradient pointing out of the fluid
+Vector3 sampleSurfaceTractionForce(int i) {
+    const float tension = activePhases[particles[i].phase].surfaceTension;
+    Vector3 surfaceTractionForce = Vector3Scale(particles[i].colorGradient, -tension*sampleColorDivergence(i));
+    return surfaceTractionForce;
+}
+
+static inline int currentThread() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// pressure and viscosity from body samples, mirroring the fluid terms with the
+// sample taking this particle's pressure (clamped so bodies never pull fluid in).
+// The opposite force goes to the sample's body, in this thread's accumulators.
+Vector3 sampleBoundaryForce(int i) {
+    if (!coupled) return Vector3Zero();
+    const Particle& particle = particles[i];
+    const float pressure = fmaxf(particle.pressure, 0.0f);
+    const float ownViscosity = activePhases[particle.phase].viscosity;
+    const float reaction = -particle.mass/particle.density;
+    const int bodies = (int)rigidBodies.size();
+    Vector3* bodyForce = &threadBodyForce[currentThread()*bodies];
+    Vector3* bodyTorque = &threadBodyTorque[currentThread()*bodies];
+
+    Vector3 boundaryForce = Vector3Zero();
+    for (int k = boundaryNeighbors.start[i]; k < boundaryNeighbors.start[i + 1]; k++) {
+        const int b = boundaryNeighbors.index[k];
+        Vector3 r = Vector3Subtract(particle.position, boundaryPositions[b]);
+        float magnitude = Vector3Length(r);
+        float inverseMagnitude = magnitude > 0.0f ? 1.0f/magnitude : 0.0f;
+        Vector3 force = Vector3Scale(r, -inverseMagnitude*boundaryVolumes[b]*pressure*spikyGradient(magnitude));
+        force = Vector3Add(force, Vector3Scale(Vector3Subtract(boundaryVelocities[b], particle.velocity), ownViscosity*boundaryVolumes[b]*viscosityLaplacian(magnitude)));
+        boundaryForce = Vector3Add(boundaryForce, force);
+
+        const int body = boundaryBody[b];
+        Vector3 onBody = Vector3Scale(force, reaction);
+        bodyForce[body] = Vector3Add(bodyForce[body], onBody);
+        bodyTorque[body] = Vector3Add(bodyTorque[body], Vector3CrossProduct(Vector3Subtract(boundaryPositions[b], rigidBodies[body].position), onBody));
+    }
+    return boundaryForce;
+}
+
+// gradient and Laplacian of the interface color field, self term 0 since own phase counts 0
+template <bool Fixed>
+static void sumInterface(int i, Vector3& gradient, float& laplacian) {
+    const Particle& particle = particles[i];
+    const float* tension = pairTension[particle.phase];
+    Sum3<Fixed> interfaceGradient(fixedUnit.interfaceGradient);
+    Sum<Fixed> interfaceLaplacian(fixedUnit.interfaceLaplacian);
+    for (int k = particleNeighbors.start[i]; k < particleNeighbors.start[i + 1]; k++) {
+        const Particle& other = particles[particleNeighbors.index[k]];
+        Vector3 r = Vector3Subtract(other.position, particle.position);
+        float r2 = Vector3LengthSqr(r);
+        float weight = tension[other.phase]*other.mass*(1.0f/other.density);
+        interfaceGradient.add(Vector3Scale(r, weight*poly6GradientOverR(r2)));
+        interfaceLaplacian.add(weight*poly6Laplacian(r2));
+    }
+    gradient = interfaceGradient.get();
+    laplacian = interfaceLaplacian.get();
+}
+
+static void sampleInterface(int i, Vector3& gradient, float& laplacian) {
+    if (deterministicMode) sumInterface<true>(i, gradient, laplacian);
+    else sumInterface<false>(i, gradient, laplacian);
+}
+
+// -sigma*laplacian(c)*n, with sigma already folded into the interface color field
+Vector3 sampleInterfaceTensionForce(int i) {
+    if (!multiPhase) return Vector3Zero();
+    return Vector3Scale(Vector3Normalize(interfaceGradient[i]), -interfaceLaplacian[i]);
+}
+
+FluidPhase makeFluidPhase(float restDensity, float viscosity, float surfaceTension) {
+    FluidPhase phase;
+    phase.restDensity = restDensity;
+    phase.viscosity = viscosity;
+    phase.surfaceTension = surfaceTension;
+    for (int p = 0; p < maxFluidPhases; p++) phase.interfaceTension[p] = 0.0f;
+    return phase;
+}
+
+void groupParticlesByPhase() {
+    bool grouped = true;
+    for (size_t i = 1; i < particles.size() && grouped; i++) grouped = particles[i - 1].phase <= particles[i].phase;
+    if (grouped) return;
+    invalidateParticleGrid();
+    std::stable_sort(particles.begin(), particles.end(), [](const Particle& a, const Particle& b) { return a.phase < b.phase; });
+}
+
+static void updatePhaseTable() {
+    if (fluidPhases.empty()) activePhases.assign(1, makeFluidPhase(restDensity, viscosity, surfaceTension));
+    else activePhases.assign(fluidPhases.begin(), fluidPhases.begin() + std::min((int)fluidPhases.size(), maxFluidPhases));
+
+    const int count = (int)activePhases.size();
+    for (int a = 0; a < maxFluidPhases; a++) {
+        for (int b = 0; b < maxFluidPhases; b++) {
+            pairTension[a][b] = (a != b && a < count && b < count) ? 0.5f*(activePhases[a].interfaceTension[b] + activePhases[b].interfaceTension[a]) : 0.0f;
+        }
+    }
+    multiPhase = count > 1;
+
+    // out-of-range phases fall back to the first, then the table order is restored
+    for (Particle& p : particles) p.phase = (p.phase >= 0 && p.phase < count) ? p.phase : 0;
+    if (multiPhase) groupParticlesByPhase();
+}
+
+void resetDiagnostics() {
+    diagnostics.failedSteps = 0;
+    diagnostics.stalled = false;
+    hasReference = false;
+    energyAlarmRaised = false;
+    momentumAlarmRaised = false;
+}
+
+static void raiseDriftAlarm(const char* quantity, double drift, double tolerance) {
+    if (driftAlarm.action == DRIFT_IGNORE) return;
+    fprintf(stderr, "fluid65: %s drift %.3g exceeds tolerance %.3g\n", quantity, drift, tolerance);
+    if (driftAlarm.action == DRIFT_ABORT) abort();
+}
+
+static void checkDrift(double mass) {
+    if (!hasReference) {
+        reference = diagnostics;
+        referenceMass = mass;
+        hasReference = true;
+        return;
+    }
+
+    double energy = diagnostics.kineticEnergy + diagnostics.potentialEnergy;
+    double referenceEnergy = reference.kineticEnergy + reference.potentialEnergy;
+    double energyScale = fmax(fabs(referenceEnergy), referenceMass*gravity*sphereSize);
+    if (energyScale <= 0.0) energyScale = fmax(reference.kineticEnergy, 1e-12);
+    double momentumScale = sqrt(2.0*referenceMass*energyScale);
+
+    if (driftAlarm.energyTolerance > 0.0) {
+        double drift = (energy - referenceEnergy)/energyScale;
+        bool exceeded = !(drift <= driftAlarm.energyTolerance);
+        if (exceeded && !energyAlarmRaised) raiseDriftAlarm("energy", drift, driftAlarm.energyTolerance);
+        energyAlarmRaised = exceeded;
+    }
+    if (driftAlarm.momentumTolerance > 0.0 && momentumScale > 0.0) {
+        double linear = Vector3Length(Vector3Subtract(diagnostics.linearMomentum, reference.linearMomentum))/momentumScale;
+        double angular = Vector3Length(Vector3Subtract(diagnostics.angularMomentum, reference.angularMomentum))/(momentumScale*sphereSize);
+        double drift = fmax(linear, angular);
+        bool exceeded = !(drift <= driftAlarm.momentumTolerance);
+        if (exceeded && !momentumAlarmRaised) raiseDriftAlarm("momentum", drift, driftAlarm.momentumTolerance);
+        momentumAlarmRaised = exceeded;
+    }
+}
+
+// per-step totals, filled in by integrateParticle
+struct StepTotals {
+    double kinetic, potential, mass;
+    double density, massOverDensity;
+    double px, py, pz;
+    double lx, ly, lz;
+    int nonFinite;
+    float maxMove2;     // largest squared displacement
+};
+
+static void addTotals(StepTotals& total, const StepTotals& part) {
+    total.kinetic += part.kinetic;
+    total.potential += part.potential;
+    total.mass += part.mass;
+    total.density += part.density;
+    total.massOverDensity += part.massOverDensity;
+    total.px += part.px; total.py += part.py; total.pz += part.pz;
+    total.lx += part.lx; total.ly += part.ly; total.lz += part.lz;
+    total.nonFinite += part.nonFinite;
+    total.maxMove2 = fmaxf(total.maxMove2, part.maxMove2);
+}
+
+static inline void computeDensity(int i) {
+    particles[i].density = sampleDensity(i);
+    particles[i].pressure = samplePressure(i);
+}
+
+static inline void computeColorGradient(int i) {
+    particles[i].colorGradient = sampleColorGradient(i);
+    if (multiPhase) sampleInterface(i, interfaceGradient[i], interfaceLaplacian[i]);
+}
+
+static inline void computeAcceleration(int i) {
+    Vector3 netForce = Vector3Add(samplePressureForce(i), Vector3Scale(externalAcceleration[i], particles[i].mass));
+    netForce = Vector3Add(netForce, sampleViscosityForce(i));
+    netForce = Vector3Add(netForce, sampleSurfaceTractionForce(i));
+    netForce = Vector3Add(netForce, sampleInterfaceTensionForce(i));
+    netForce = Vector3Add(netForce, sampleBoundaryForce(i));
+    particles[i].acceleration = Vector3Scale(netForce, 1.0f/particles[i].density);
+}
+
+// fixed-point values in units of 2^-fixedPointBits, carried in floats: they stay exact
+// while below 2^24 units. x - x is added back so non-finite values still show as NaN.
+static inline long long toFixed(float x) {
+    return llrintf(ldexpf(x, fixedPointBits));
+}
+
+static inline float fromFixed(long long n) {
+    return ldexpf((float)n, -fixedPointBits);
+}
+
+static inline Vector3 snapFixed(Vector3 v) {
+    return {fromFixed(toFixed(v.x)) + (v.x - v.x), fromFixed(toFixed(v.y)) + (v.y - v.y), fromFixed(toFixed(v.z)) + (v.z - v.z)};
+}
+
+// a + d with a on the fixed-point grid, as an integer sum of a and d rounded to it
+static inline Vector3 addFixed(Vector3 a, Vector3 d) {
+    return {fromFixed(toFixed(a.x) + toFixed(d.x)) + (d.x - d.x), fromFixed(toFixed(a.y) + toFixed(d.y)) + (d.y - d.y), fromFixed(toFixed(a.z) + toFixed(d.z)) + (d.z - d.z)};
+}
+
+static inline void integrateParticle(int i, float deltaTime, StepTotals& totals) {
+    const Vector3 dv = Vector3Scale(particles[i].acceleration, deltaTime);
+    particles[i].velocity = deterministicMode ? addFixed(particles[i].velocity, dv) : Vector3Add(particles[i].velocity, dv);
+    if (Vector3Length(particles[i].position) >= sphereSize - 1.0f) {
+        //particles[i].position = Vector3Scale(Vector3Normalize(particles[i].position), sphereSize-1.0f);
+        //particles[i].velocity = Vector3Scale(Vector3Normalize(particles[i].position), sphereSize*-0.01f);
+        if (Vector3DotProduct(particles[i].position, particles[i].velocity) > 0.0f) particles[i].velocity = Vector3Scale(Vector3Reflect(particles[i].velocity, Vector3Negate(Vector3Normalize(particles[i].position))), 0.8f);
+        if (deterministicMode) particles[i].velocity = snapFixed(particles[i].velocity);
+    }
+    const Vector3 dx = Vector3Scale(particles[i].velocity, deltaTime);
+    particles[i].position = deterministicMode ? addFixed(particles[i].position, dx) : Vector3Add(particles[i].position, dx);
+    if (trackingCells && gridCell(particleGrid, particles[i].position) != particleGrid.pointCell[i]) cellMovers[currentThread()].push_back(i);
+    totals.maxMove2 = fmaxf(totals.maxMove2, Vector3LengthSqr(dx));
+
+    const float m = particles[i].mass;
+    const Vector3 p = Vector3Scale(particles[i].velocity, m);
+    const Vector3 l = Vector3CrossProduct(particles[i].position, p);
+    totals.kinetic += 0.5f*m*Vector3LengthSqr(particles[i].velocity);
+    totals.potential += gravity*m*particles[i].position.y;
+    totals.mass += m;
+    totals.density += particles[i].density;
+    totals.massOverDensity += m/particles[i].density;
+    totals.px += p.x; totals.py += p.y; totals.pz += p.z;
+    totals.lx += l.x; totals.ly += l.y; totals.lz += l.z;
+
+    // x - x is 0 for finite x and NaN for NaN or +-inf, without a branch
+    const Vector3 q = particles[i].position, v = particles[i].velocity;
+    const float sum = q.x + q.y + q.z + v.x + v.y + v.z;
+    totals.nonFinite += (sum - sum != 0.0f);
+}
+
+static std::vector<StepTotals> threadTotals;
+
+// one global pass per phase, with a barrier between passes
+static void stepPasses(float deltaTime, StepTotals& totals) {
+    const int numParticles = (int)particles.size();
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < numParticles; i++) computeDensity(i);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < numParticles; i++) computeColorGradient(i);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < numParticles; i++) computeAcceleration(i);
+
+    // one slot per thread, summed in thread order afterwards: with the static
+    // schedule each thread always gets the same particles, so the totals come out
+    // the same from run to run
+    threadTotals.assign(getThreadCount(), StepTotals());
+    #pragma omp parallel
+    {
+        StepTotals local = {};
+        #pragma omp for schedule(static) nowait
+        for (int i = 0; i < numParticles; i++) integrateParticle(i, deltaTime, local);
+        threadTotals[currentThread()] = local;
+    }
+    for (const StepTotals& local : threadTotals) addTotals(totals, local);
+}
+
+// each phase split into spatial tiles; a tile's phase waits only for the
+// previous phase of the tiles touching it. Integration additionally waits for
+// the force phase of those tiles, which still read this tile's positions.
+static void stepTaskGraph(float deltaTime, StepTotals& totals) {
+    buildTiles(particleTiles, particleGrid, cellsPerTile);
+    const int tileCount = (int)particleTiles.pointStart.size() - 1;
+    const TileSet& tiles = particleTiles;
+
+    std::vector<StepTotals> tileTotals(tileCount, StepTotals());
+    enum { DENSITY, COLOR_GRADIENT, FORCE, INTEGRATE, PHASES };
+
+    stepGraph.clear();
+    for (int phase = 0; phase < PHASES; phase++) {
+        for (int t = 0; t < tileCount; t++) {
+            const int first = tiles.pointStart[t], last = tiles.pointStart[t + 1];
+            StepTotals* tileTotal = &tileTotals[t];
+            stepGraph.add([phase, first, last, deltaTime, tileTotal]() {
+                const std::vector<int>& points = particleTiles.points;
+                for (int k = first; k < last; k++) {
+                    const int i = points[k];
+                    switch (phase) {
+                        case DENSITY: computeDensity(i); break;
+                        case COLOR_GRADIENT: computeColorGradient(i); break;
+                        case FORCE: computeAcceleration(i); break;
+                        case INTEGRATE: integrateParticle(i, deltaTime, *tileTotal); break;
+                    }
+                }
+            });
+        }
+    }
+    for (int phase = 1; phase < PHASES; phase++) {
+        for (int t = 0; t < tileCount; t++) {
+            for (int k = tiles.neighborStart[t]; k < tiles.neighborStart[t + 1]; k++) {
+                stepGraph.depend(phase*tileCount + t, (phase - 1)*tileCount + tiles.neighbors[k]);
+            }
+        }
+    }
+    stepGraph.run();
+
+    // summed in tile order so the totals do not depend on which thread ran what
+    for (int t = 0; t < tileCount; t++) addTotals(totals, tileTotals[t]);
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void invalidateParticleGrid() {
+    gridCurrent = false;
+    gridDrift = INFINITY;
+}
+
+// applies the cell changes recorded by the last integration pass, false if the grid needs a rebuild
+static bool updateParticleGrid() {
+    const int numParticles = (int)particles.size();
+    if (!gridCurrent || gridRadius != sampleRadius || (int)particleGrid.pointCell.size() != numParticles) return false;
+    movers.clear();
+    for (const std::vector<int>& list : cellMovers) movers.insert(movers.end(), list.begin(), list.end());
+    // in index order whichever thread found them, so the cells come out the same
+    std::sort(movers.begin(), movers.end());
+    return updateGrid(particleGrid, &particles[0].position, sizeof(Particle), movers, gridRebuildFraction);
+}
+
+static void buildDenseGrid() {
+    const int numParticles = (int)particles.size();
+    const Vector3* positions = numParticles > 0 ? &particles[0].position : nullptr;
+    if (!(incrementalGrid && updateParticleGrid())) {
+        buildGrid(particleGrid, positions, numParticles, sizeof(Particle), sampleRadius, incrementalGrid ? gridSlack : 0);
+        gridRadius = sampleRadius;
+    }
+    denseGridBuilt = true;
+}
+
+// the dense grid, or the sparse one if the dense grid had to coarsen its cells
+// and would scan far more candidates
+static NeighborSearch gridSearch() {
+    if (!denseGridBuilt) buildDenseGrid();
+    return particleGrid.cellSize > sampleRadius ? NEIGHBOR_SEARCH_SPARSE_GRID : NEIGHBOR_SEARCH_GRID;
+}
+
+static void buildParticleNeighbors() {
+    const int numParticles = (int)particles.size();
+    const Vector3* positions = numParticles > 0 ? &particles[0].position : nullptr;
+    denseGridBuilt = false;
+    if (incrementalGrid || stepScheduler == SCHEDULER_TASK_GRAPH) buildDenseGrid();
+    gridCurrent = false;
+    gridDrift = 0.0f;
+
+    trackingCells = incrementalGrid && particleGrid.slack > 0;
+    if (trackingCells) {
+        cellMovers.resize(getThreadCount());
+        for (std::vector<int>& list : cellMovers) list.clear();
+    }
+
+    // a timed choice could differ between machines, so deterministic mode sticks to the dense grid
+    NeighborSearch search = deterministicMode ? NEIGHBOR_SEARCH_GRID : neighborSearch;
+    if (search == NEIGHBOR_SEARCH_AUTO) {
+        if (numParticles > bruteForceMaxParticles) {
+            search = gridSearch();
+        } else if (numParticles != autoChoiceCount || stepsSinceAutoChoice >= autoSearchInterval) {
+            // both builds produce the same pairs, so the timed one that wins is simply kept.
+            // The grid side pays for its grids, unless tiles or tracking built the dense one anyway.
+            auto start = std::chrono::steady_clock::now();
+            buildNeighborListBruteForce(particleNeighbors, positions, numParticles, sizeof(Particle), sampleRadius);
+            double bruteForceSeconds = secondsSince(start);
+            start = std::chrono::steady_clock::now();
+            const NeighborSearch grid = gridSearch();
+            if (grid == NEIGHBOR_SEARCH_SPARSE_GRID) {
+                buildSparseGrid(sparseParticleGrid, positions, numParticles, sizeof(Particle), sampleRadius);
+                buildNeighborList(particleNeighbors, sparseParticleGrid, positions, numParticles, sizeof(Particle), sampleRadius);
+            } else {
+                buildNeighborList(particleNeighbors, particleGrid, positions, numParticles, sizeof(Particle), sampleRadius);
+            }
+            double gridSeconds = secondsSince(start);
+
+            autoChoice = bruteForceSeconds < gridSeconds ? NEIGHBOR_SEARCH_BRUTE_FORCE : NEIGHBOR_SEARCH_GRID;
+            autoChoiceCount = numParticles;
+            stepsSinceAutoChoice = 0;
+            lastSearch = autoChoice == NEIGHBOR_SEARCH_GRID ? grid : autoChoice;
+            return;
+        } else {
+            search = autoChoice == NEIGHBOR_SEARCH_GRID ? gridSearch() : autoChoice;
+            stepsSinceAutoChoice++;
+        }
+    }
+
+    if (search == NEIGHBOR_SEARCH_BRUTE_FORCE) {
+        buildNeighborListBruteForce(particleNeighbors, positions, numParticles, sizeof(Particle), sampleRadius);
+    } else if (search == NEIGHBOR_SEARCH_SPARSE_GRID) {
+        buildSparseGrid(sparseParticleGrid, positions, numParticles, sizeof(Particle), sampleRadius);
+        buildNeighborList(particleNeighbors, sparseParticleGrid, positions, numParticles, sizeof(Particle), sampleRadius);
+    } else {
+        if (!denseGridBuilt) buildDenseGrid();
+        buildNeighborList(particleNeighbors, particleGrid, positions, numParticles, sizeof(Particle), sampleRadius);
+    }
+    lastSearch = search;
+}
+
+// fluid particles only query the samples' own grid, and only when inside its bounds,
+// so a step without bodies near the fluid costs a bounds test per particle
+static void buildBoundary() {
+    boundaryPositions.clear();
+    boundaryVelocities.clear();
+    boundaryVolumes.clear();
+    boundaryBody.clear();
+    for (int body = 0; body < (int)rigidBodies.size(); body++) {
+        RigidBody& rigidBody = rigidBodies[body];
+        updateSampleVolumes(rigidBody, sampleRadius);
+        for (int k = 0; k < (int)rigidBody.samples.size(); k++) {
+            Vector3 position = sampleWorldPosition(rigidBody, k);
+            boundaryPositions.push_back(position);
+            boundaryVelocities.push_back(sampleWorldVelocity(rigidBody, position));
+            boundaryVolumes.push_back(rigidBody.sampleVolumes[k]);
+            boundaryBody.push_back(body);
+        }
+    }
+
+    const int numParticles = (int)particles.size();
+    coupled = !boundaryPositions.empty() && numParticles > 0 && boundaryDensity > 0.0f;
+    if (!coupled) return;
+
+    buildGrid(boundaryGrid, boundaryPositions.data(), (int)boundaryPositions.size(), sizeof(Vector3), sampleRadius, 0);
+    buildCrossNeighborList(boundaryNeighbors, boundaryGrid, boundaryPositions.data(), sizeof(Vector3), &particles[0].position, numParticles, sizeof(Particle), sampleRadius, 0.0f);
+
+    bodyThreads = getThreadCount();
+    threadBodyForce.assign(bodyThreads*rigidBodies.size(), Vector3Zero());
+    threadBodyTorque.assign(bodyThreads*rigidBodies.size(), Vector3Zero());
+}
+
+// sums the per-thread reactions and moves the bodies, false if one went non-finite
+static bool stepRigidBodies(float deltaTime, const StepTotals& totals) {
+    const int bodies = (int)rigidBodies.size();
+    for (int body = 0; body < bodies; body++) {
+        Vector3 force = Vector3Zero(), torque = Vector3Zero();
+        for (int t = 0; coupled && t < bodyThreads; t++) {
+            force = Vector3Add(force, threadBodyForce[t*bodies + body]);
+            torque = Vector3Add(torque, threadBodyTorque[t*bodies + body]);
+        }
+        rigidBodies[body].force = force;
+        rigidBodies[body].torque = torque;
+    }
+
+    const int numParticles = (int)particles.size();
+    if (numParticles == 0) return true;
+    boundaryDensity = (float)(totals.density/numParticles);
+    integrateRigidBodies(deltaTime, boundaryDensity, (float)(totals.massOverDensity/numParticles));
+
+    for (const RigidBody& body : rigidBodies) {
+        const float sum = body.position.x + body.position.y + body.position.z + body.velocity.x + body.velocity.y + body.velocity.z;
+        if (sum - sum != 0.0f) return false;
+    }
+    return true;
+}
+
+NeighborSearch activeNeighborSearch() {
+    return lastSearch;
+}
+
+void queryParticles(NeighborList& results, const Vector3* points, int count, size_t stride, float radius) {
+    const int numParticles = (int)particles.size();
+    const Vector3* positions = numParticles > 0 ? &particles[0].position : nullptr;
+    const bool current = gridDrift < INFINITY;
+    const bool sparse = current && lastSearch == NEIGHBOR_SEARCH_SPARSE_GRID && (int)sparseParticleGrid.cellPoints.size() == numParticles;
+    const bool dense = current && denseGridBuilt && (int)particleGrid.pointCell.size() == numParticles;
+    if (sparse) {
+        buildCrossNeighborList(results, sparseParticleGrid, positions, sizeof(Particle), points, count, stride, radius, gridDrift);
+    } else if (dense) {
+        buildCrossNeighborList(results, particleGrid, positions, sizeof(Particle), points, count, stride, radius, gridDrift);
+    } else {
+        // the grids are stale, or brute force built none
+        buildGrid(queryGrid, positions, numParticles, sizeof(Particle), radius > 0.0f ? radius : sampleRadius, 0);
+        buildCrossNeighborList(results, queryGrid, positions, sizeof(Particle), points, count, stride, radius, 0.0f);
+    }
+}
+
+// a power of two unit that keeps any sum below bound under 2^61 units
+static double fixedUnitFor(double bound) {
+    if (!(bound > 0.0) || !std::isfinite(bound)) return 1.0;
+    return ldexp(1.0, ilogb(bound) + 2 - 62);
+}
+
+// bounds from the state at the start of the step, since the task graph runs the
+// phases without a barrier in between. m/rho never exceeds 1/W(0) because every
+// density includes the particle's own m*W(0).
+static void updateFixedUnits() {
+    const int numParticles = (int)particles.size();
+    float maxMass = 0.0f, minMass = INFINITY, maxSpeed2 = 0.0f;
+    int maxNeighbors = 0, maxBoundaryNeighbors = 0;
+    #pragma omp parallel for schedule(static) reduction(max:maxMass, maxSpeed2, maxNeighbors, maxBoundaryNeighbors) reduction(min:minMass)
+    for (int i = 0; i < numParticles; i++) {
+        maxMass = std::max(maxMass, particles[i].mass);
+        minMass = std::min(minMass, particles[i].mass);
+        maxSpeed2 = std::max(maxSpeed2, Vector3LengthSqr(particles[i].velocity));
+        maxNeighbors = std::max(maxNeighbors, particleNeighbors.start[i + 1] - particleNeighbors.start[i]);
+        if (coupled) maxBoundaryNeighbors = std::max(maxBoundaryNeighbors, boundaryNeighbors.start[i + 1] - boundaryNeighbors.start[i]);
+    }
+    float maxRestDensity = 0.0f, maxViscosity = 0.0f, maxTension = 0.0f;
+    for (const FluidPhase& phase : activePhases) {
+        maxRestDensity = std::max(maxRestDensity, phase.restDensity);
+        maxViscosity = std::max(maxViscosity, phase.viscosity);
+    }
+    for (int a = 0; a < maxFluidPhases; a++) {
+        for (int b = 0; b < maxFluidPhases; b++) maxTension = std::max(maxTension, fabsf(pairTension[a][b]));
+    }
+    float maxSampleVolume = 0.0f;
+    for (float volume : boundaryVolumes) maxSampleVolume = std::max(maxSampleVolume, volume);
+
+    const double h = kernel.h, h4 = (double)kernel.h2*kernel.h2;
+    const double selfWeight = poly6AtZero();
+    const double volume = 1.0/selfWeight;
+    const double gradient = 6.0*kernel.poly6*h4*h;     // |poly6GradientOverR(r2)*r| <= 6*poly6*h^4*h
+    const double laplacian = 6.0*kernel.poly6*h4;       // |poly6Laplacian| peaks at r = 0
+    const double terms = maxNeighbors + 1.0;
+
+    const double density = terms*maxMass*selfWeight + maxBoundaryNeighbors*(double)boundaryDensity*maxSampleVolume*selfWeight;
+    const double pressure = fabs(gasConstant)*(density + maxRestDensity);
+    const double colorGradient = terms*volume*gradient;
+
+    fixedUnit.density = fixedUnitFor(density);
+    fixedUnit.colorGradient = fixedUnitFor(colorGradient);
+    fixedUnit.colorDivergence = fixedUnitFor(2.0*colorGradient);    // unit normals differ by at most 2
+    fixedUnit.colorSupport = fixedUnitFor(colorGradient*h);
+    fixedUnit.pressureForce = fixedUnitFor(terms*maxMass/(minMass*selfWeight)*pressure*3.0*kernel.spiky*kernel.h2);
+    fixedUnit.viscosityForce = fixedUnitFor(terms*maxViscosity*volume*2.0*sqrt(maxSpeed2)*kernel.viscosity*h);
+    fixedUnit.interfaceGradient = fixedUnitFor(maxTension*colorGradient);
+    fixedUnit.interfaceLaplacian = fixedUnitFor(maxTension*terms*volume*laplacian);
+}
+
+// totals of the last finite stepParticles, published once updateParticles keeps the step
+static StepTotals stepTotals;
+
+// one solver step, false if it produced a non-finite particle
+static bool stepParticles(float deltaTime) {
+    updatePhaseTable();
+
+    const int numParticles = (int)particles.size();
+    const Vector3* positions = numParticles > 0 ? &particles[0].position : nullptr;
+
+    updateKernelConstants();
+    buildParticleNeighbors();
+    buildBoundary();
+    if (deterministicMode) updateFixedUnits();
+
+    if (multiPhase) {
+        interfaceGradient.resize(numParticles);
+        interfaceLaplacian.resize(numParticles);
+    }
+
+    externalAcceleration.assign(numParticles, {0.0f, -gravity, 0.0f});
+    applyForceFields(forceFields, positions, numParticles, sizeof(Particle), externalAcceleration.data());
+
+    StepTotals totals = {};
+    if (stepScheduler == SCHEDULER_TASK_GRAPH) stepTaskGraph(deltaTime, totals);
+    else stepPasses(deltaTime, totals);
+    if (totals.nonFinite > 0) return false;
+    gridCurrent = trackingCells;
+    gridDrift += sqrtf(totals.maxMove2);
+    if (!stepRigidBodies(deltaTime, totals)) return false;
+    stepTotals = totals;
+    return true;
+}
+
+// once the whole step is kept: publish its totals, check them for drift, and
+// run what follows a step
+static void acceptStep(float deltaTime) {
+    diagnostics.kineticEnergy = stepTotals.kinetic;
+    diagnostics.potentialEnergy = stepTotals.potential;
+    diagnostics.linearMomentum = {(float)stepTotals.px, (float)stepTotals.py, (float)stepTotals.pz};
+    diagnostics.angularMomentum = {(float)stepTotals.lx, (float)stepTotals.ly, (float)stepTotals.lz};
+    checkDrift(stepTotals.mass);
+    if (secondarySettings.enabled) updateSecondaryParticles(deltaTime);
+    if (!probes.empty()) updateProbes();
+}
+
+bool updateParticles(float deltaTime) {
+    if (diagnostics.stalled) return false;
+    if (!blowupGuard.enabled) {
+        if (!stepParticles(deltaTime)) {
+            diagnostics.failedSteps++;
+            return false;
+        }
+        acceptStep(deltaTime);
+        return true;
+    }
+
+    rollbackState = particles;
+    rollbackBodies = rigidBodies;
+    int substeps = 1;
+    float substep = deltaTime;
+    for (int attempt = 0; ; attempt++) {
+        bool finite = true;
+        for (int s = 0; s < substeps && finite; s++) finite = stepParticles(substep);
+        if (finite) {
+            acceptStep(deltaTime);
+            return true;
+        }
+
+        particles = rollbackState;
+        rigidBodies = rollbackBodies;
+        invalidateParticleGrid();
+        blowupCount++;
+        if (attempt == blowupGuard.maxRetries) {
+            fprintf(stderr, "fluid65: non-finite state persists at dt=%g, stalled at the last finite state\n", substep);
+            diagnostics.failedSteps++;
+            diagnostics.stalled = true;
+            return false;
+        }
+        substeps *= 2;
+        substep *= 0.5f;
+        fprintf(stderr, "fluid65: non-finite state, rolled back and retrying with dt=%g\n", substep);
+    }
+}
+
+int getThreadCount() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void setThreadCount(int threads) {
+#ifdef _OPENMP
+    if (threads > 0) omp_set_num_threads(threads);
+#else
+    (void)threads;
+#endif
+}
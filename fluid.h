@@ -0,0 +1,191 @@
+// references: https://matthias-research.github.io/pages/publications/sca03.pdf
+
+#pragma once
+
+#include "forcefields.h"
+#include "grid.h"
+
+#include <raymath.h>
+#include <vector>
+
+// solver parameters, read at the start of every step
+extern float sphereSize;
+
+extern float sampleRadius;
+
+extern float restDensity;
+
+extern float gasConstant;
+
+extern float viscosity;
+
+extern float surfaceTension;
+
+// downward body force per unit mass, applied together with forceFields
+extern float gravity;
+
+struct Particle {
+    Vector3 position;
+    Vector3 velocity;
+    Vector3 acceleration;
+    float mass;
+
+    float density;
+    float pressure;
+    Vector3 colorGradient;
+
+    int phase;      // index into fluidPhases
+};
+
+const int maxFluidPhases = 4;
+
+struct FluidPhase {
+    float restDensity;
+    float viscosity;                            // a pair uses the mean of both phases
+    float surfaceTension;                       // at the free surface
+    float interfaceTension[maxFluidPhases];     // against each phase, averaged with that phase's entry
+};
+
+// the phase table; when empty every particle is one phase made from the global
+// restDensity, viscosity and surfaceTension. Particles are kept grouped by phase.
+extern std::vector<FluidPhase> fluidPhases;
+
+FluidPhase makeFluidPhase(float restDensity, float viscosity, float surfaceTension);
+
+// stable-sorts particles so each phase is contiguous; a no-op when they already are
+void groupParticlesByPhase();
+
+extern std::vector<Particle> particles;
+
+// rebuilt at the start of every step; the neighbor list holds each particle's
+// neighbors within sampleRadius, excluding the particle itself. particleGrid is
+// only built when the dense search, the task graph or incrementalGrid uses it.
+extern UniformGrid particleGrid;
+extern SparseGrid sparseParticleGrid;    // only built when the sparse search is used
+extern NeighborList particleNeighbors;
+
+float W_poly6(Vector3 r, float h);
+float W_poly6_Gradient(Vector3 r, float h);
+float W_poly6_Laplacian(Vector3 r, float h);
+float W_viscosity_Laplacian(Vector3 r, float h);
+float W_spiky(Vector3 r, float h);
+float W_spiky_Gradient(Vector3 r, float h);
+
+// fields at particles[i] from its neighbor list, self contribution added analytically
+float sampleDensity(int i);
+float samplePressure(int i);
+float sampleColor(int i);
+Vector3 sampleColorGradient(int i);
+float sampleColorDivergence(int i);     // curvature of the surface, 0 off it
+Vector3 samplePressureForce(int i);
+Vector3 sampleViscosityForce(int i);
+Vector3 sampleSurfaceTractionForce(int i);
+Vector3 sampleInterfaceTensionForce(int i);
+Vector3 sampleBoundaryForce(int i);     // from rigidBodies, only valid inside updateParticles
+
+// totals over all particles, reduced inside the integration pass of updateParticles
+struct Diagnostics {
+    double kineticEnergy;
+    double potentialEnergy;     // gravity, relative to y = 0
+    Vector3 linearMomentum;
+    Vector3 angularMomentum;    // about the sphere center
+
+    int failedSteps;            // since resetDiagnostics(): steps left non-finite, or given up on by the blowup guard
+    bool stalled;               // the guard gave up; updateParticles does nothing until this is cleared
+};
+
+enum DriftAction {
+    DRIFT_IGNORE,
+    DRIFT_LOG,
+    DRIFT_ABORT
+};
+
+// drift is measured against the first step after resetDiagnostics(); energy is
+// relative to max(|E0|, M*g*sphereSize), linear momentum to sqrt(2*M*that energy)
+// and angular momentum to the same times sphereSize. A tolerance of 0 disables that check.
+struct DriftAlarm {
+    DriftAction action;
+    double energyTolerance;     // only energy gain is flagged, the solver is dissipative
+    double momentumTolerance;
+};
+
+extern Diagnostics diagnostics;
+extern DriftAlarm driftAlarm;
+
+void resetDiagnostics();
+
+// a step that leaves any position or velocity non-finite is rolled back and
+// redone as 2, 4, ... substeps of half the time step, up to maxRetries times.
+// After that the particles keep the last finite state and diagnostics.stalled is
+// set, so the same failing step isn't retried on every call; clear it (after
+// changing the state or the parameters) to try again.
+struct BlowupGuard {
+    bool enabled;
+    int maxRetries;
+};
+
+extern BlowupGuard blowupGuard;
+extern int blowupCount;     // rolled back steps since startup
+
+// with incrementalGrid, particleGrid is built with free slots in every cell
+// and from then on only the particles the integration pass saw change cell are
+// moved, until a cell overflows, a particle leaves the grid or gridRebuildFraction
+// of the particles have moved since the last build. Anything that moves or
+// reorders particles outside updateParticles must call invalidateParticleGrid.
+extern bool incrementalGrid;
+extern int gridSlack;
+extern float gridRebuildFraction;
+void invalidateParticleGrid();
+
+// how the neighbor list is built. AUTO times the all-pairs build against a grid
+// on the current particles and keeps the faster one, re-checking every
+// autoSearchInterval steps or when the particle count changes; above
+// bruteForceMaxParticles it always uses a grid. The grid is the dense one unless
+// the particles spread so far that it had to coarsen its cells, then the sparse one.
+enum NeighborSearch {
+    NEIGHBOR_SEARCH_AUTO,
+    NEIGHBOR_SEARCH_GRID,
+    NEIGHBOR_SEARCH_BRUTE_FORCE,
+    NEIGHBOR_SEARCH_SPARSE_GRID
+};
+
+extern NeighborSearch neighborSearch;
+extern int bruteForceMaxParticles;
+extern int autoSearchInterval;
+
+// the search the last step actually used, never AUTO
+NeighborSearch activeNeighborSearch();
+
+// for each of count points (stride bytes apart) the particles within radius of
+// it, as lists into particles. Runs against the grid of the last step, searched
+// wider by how far the particles have moved since, so the lists are exact for
+// the current positions; without a usable grid one is built for the query.
+// Not to be called while updateParticles runs.
+void queryParticles(NeighborList& results, const Vector3* points, int count, size_t stride, float radius);
+
+// deterministic mode keeps positions and velocities on a fixed-point grid of
+// 2^-fixedPointBits and integrates them as integers, sums density, color field,
+// curvature, interface color field, pressure and viscosity over the neighbors as
+// integers (independent of neighbor order), and always uses the grid neighbor search. Together with a core built
+// without floating point contraction (FLUID65_STRICT_FP) a run gives bit-identical
+// trajectories on any machine and thread count. Rigid body reactions are still
+// summed per thread in float.
+extern bool deterministicMode;
+extern int fixedPointBits;
+
+// how a step's phases (density, color gradient, forces, integration) are run:
+// as global passes, or as a task graph of spatial tiles with no global barriers
+enum StepScheduler {
+    SCHEDULER_PASSES,
+    SCHEDULER_TASK_GRAPH
+};
+
+extern StepScheduler stepScheduler;
+extern int cellsPerTile;    // task graph tile edge, in grid cells
+
+// false if the step was not taken: it went non-finite, or the guard is stalled
+bool updateParticles(float deltaTime);
+
+// number of worker threads used by updateParticles (1 when built without OpenMP)
+int getThreadCount();
+void setThreadCount(int threads);
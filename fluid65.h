@@ -0,0 +1,89 @@
+/* C API for embedding the Fluid65 solver. Plain C types only, no allocation
+ * on the caller's behalf: particle data is copied into buffers the caller owns.
+ * The solver state is global, so only one simulation can exist at a time. */
+
+#ifndef FLUID65_H
+#define FLUID65_H
+
+#if defined(_WIN32)
+    #if defined(FLUID65_BUILD)
+        #define FLUID65_API __declspec(dllexport)
+    #else
+        #define FLUID65_API __declspec(dllimport)
+    #endif
+#else
+    #define FLUID65_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fluid65_sim fluid65_sim;
+
+/* non-negative values are successes (counts), negative values errors */
+enum {
+    FLUID65_OK = 0,
+    FLUID65_ERROR_INVALID_ARGUMENT = -1,
+    FLUID65_ERROR_BUFFER_TOO_SMALL = -2,
+    FLUID65_ERROR_OUT_OF_MEMORY = -3,
+    FLUID65_ERROR_INTERNAL = -4,
+    FLUID65_ERROR_UNSTABLE = -5
+};
+
+typedef enum {
+    FLUID65_SCENE_DROP = 0,
+    FLUID65_SCENE_DAM_BREAK = 1,
+    FLUID65_SCENE_POOL = 2,
+    FLUID65_SCENE_LAYERS = 3,
+    FLUID65_SCENE_BODIES = 4
+} fluid65_scene;
+
+typedef enum {
+    FLUID65_PARAM_SPHERE_SIZE = 0,
+    FLUID65_PARAM_SAMPLE_RADIUS = 1,
+    FLUID65_PARAM_REST_DENSITY = 2,
+    FLUID65_PARAM_GAS_CONSTANT = 3,
+    FLUID65_PARAM_VISCOSITY = 4,
+    FLUID65_PARAM_SURFACE_TENSION = 5,
+    FLUID65_PARAM_GRAVITY = 6
+} fluid65_param;
+
+/* NULL if a simulation already exists, the arguments are invalid, memory ran out
+ * or the scene could not be set up; a failed create leaves no scene behind */
+FLUID65_API fluid65_sim* fluid65_create(fluid65_scene scene, int particle_count, unsigned int seed);
+FLUID65_API void fluid65_destroy(fluid65_sim* sim);
+
+/* FLUID65_ERROR_UNSTABLE if a step went non-finite and halving dt could not
+ * recover it; the particles keep the last finite state and later steps fail
+ * the same way until the simulation is created again */
+FLUID65_API int fluid65_step(fluid65_sim* sim, int steps, float dt);
+FLUID65_API int fluid65_particle_count(const fluid65_sim* sim);
+FLUID65_API int fluid65_set_threads(fluid65_sim* sim, int threads);
+
+/* FLUID65_ERROR_INVALID_ARGUMENT for a non-finite value, or a sphere size or
+ * sample radius that is not positive; the parameter keeps its old value */
+FLUID65_API int fluid65_set_param(fluid65_sim* sim, fluid65_param param, float value);
+FLUID65_API int fluid65_get_param(const fluid65_sim* sim, fluid65_param param, float* value);
+
+/* copy x, y, z per particle into out, which holds capacity particles (3*capacity
+ * floats); returns the number of particles written */
+FLUID65_API int fluid65_get_positions(const fluid65_sim* sim, float* out, int capacity);
+FLUID65_API int fluid65_get_velocities(const fluid65_sim* sim, float* out, int capacity);
+
+/* one float per particle */
+FLUID65_API int fluid65_get_densities(const fluid65_sim* sim, float* out, int capacity);
+
+/* the particles within radius of each of count points (x, y, z each), as
+ * compressed rows: the neighbors of point q are index[start[q]..start[q+1]).
+ * start holds count + 1 ints and is always filled; index holds capacity ints.
+ * Returns the number of neighbors in all, or FLUID65_ERROR_BUFFER_TOO_SMALL
+ * when that is more than capacity, with start[count] telling how many. */
+FLUID65_API int fluid65_query_particles(fluid65_sim* sim, const float* points, int count, float radius,
+                                        int* start, int* index, int capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
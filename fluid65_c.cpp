@@ -0,0 +1,145 @@
+#include "fluid65.h"
+
+#include "fluid.h"
+#include "forcefields.h"
+#include "rigidbody.h"
+#include "scenes.h"
+#include "secondary.h"
+
+#include <cmath>
+#include <cstddef>
+#include <new>
+
+struct fluid65_sim {
+    int unused;
+};
+
+static fluid65_sim* liveSimulation = nullptr;
+static NeighborList queryResults;
+
+static float* parameter(fluid65_param param) {
+    switch (param) {
+        case FLUID65_PARAM_SPHERE_SIZE: return &sphereSize;
+        case FLUID65_PARAM_SAMPLE_RADIUS: return &sampleRadius;
+        case FLUID65_PARAM_REST_DENSITY: return &restDensity;
+        case FLUID65_PARAM_GAS_CONSTANT: return &gasConstant;
+        case FLUID65_PARAM_VISCOSITY: return &viscosity;
+        case FLUID65_PARAM_SURFACE_TENSION: return &surfaceTension;
+        case FLUID65_PARAM_GRAVITY: return &gravity;
+    }
+    return nullptr;
+}
+
+// drops everything setupScene builds, so a failed create leaves nothing half made
+static void clearScene() {
+    particles.clear();
+    particles.shrink_to_fit();
+    fluidPhases.clear();
+    rigidBodies.clear();
+    forceFields.clear();
+    clearSecondaryParticles();
+    invalidateParticleGrid();
+    resetDiagnostics();
+}
+
+// copies count floats per particle from the member at offset into out
+static int copyOut(const fluid65_sim* sim, float* out, int capacity, size_t offset, int count) {
+    if (!sim || sim != liveSimulation || !out || capacity < 0) return FLUID65_ERROR_INVALID_ARGUMENT;
+    const int n = (int)particles.size();
+    if (capacity < n) return FLUID65_ERROR_BUFFER_TOO_SMALL;
+    for (int i = 0; i < n; i++) {
+        const float* in = (const float*)((const char*)&particles[i] + offset);
+        for (int c = 0; c < count; c++) out[count*i + c] = in[c];
+    }
+    return n;
+}
+
+fluid65_sim* fluid65_create(fluid65_scene scene, int particle_count, unsigned int seed) {
+    if (liveSimulation || particle_count < 0 || scene < 0 || scene >= (int)SCENE_COUNT) return nullptr;
+    try {
+        setupScene((Scene)scene, particle_count, seed);
+        liveSimulation = new fluid65_sim();
+    } catch (...) {
+        clearScene();
+        return nullptr;
+    }
+    return liveSimulation;
+}
+
+void fluid65_destroy(fluid65_sim* sim) {
+    if (!sim || sim != liveSimulation) return;
+    clearScene();
+    delete liveSimulation;
+    liveSimulation = nullptr;
+}
+
+int fluid65_step(fluid65_sim* sim, int steps, float dt) {
+    if (!sim || sim != liveSimulation || steps < 0 || !(dt > 0.0f)) return FLUID65_ERROR_INVALID_ARGUMENT;
+    try {
+        for (int s = 0; s < steps; s++) {
+            if (!updateParticles(dt)) return FLUID65_ERROR_UNSTABLE;
+        }
+    } catch (const std::bad_alloc&) {
+        return FLUID65_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return FLUID65_ERROR_INTERNAL;
+    }
+    return FLUID65_OK;
+}
+
+int fluid65_particle_count(const fluid65_sim* sim) {
+    if (!sim || sim != liveSimulation) return FLUID65_ERROR_INVALID_ARGUMENT;
+    return (int)particles.size();
+}
+
+int fluid65_set_threads(fluid65_sim* sim, int threads) {
+    if (!sim || sim != liveSimulation || threads < 1) return FLUID65_ERROR_INVALID_ARGUMENT;
+    setThreadCount(threads);
+    return FLUID65_OK;
+}
+
+int fluid65_set_param(fluid65_sim* sim, fluid65_param param, float value) {
+    float* target = parameter(param);
+    if (!sim || sim != liveSimulation || !target || !std::isfinite(value)) return FLUID65_ERROR_INVALID_ARGUMENT;
+    // the grids and kernels divide by both
+    if ((param == FLUID65_PARAM_SPHERE_SIZE || param == FLUID65_PARAM_SAMPLE_RADIUS) && !(value > 0.0f)) return FLUID65_ERROR_INVALID_ARGUMENT;
+    *target = value;
+    return FLUID65_OK;
+}
+
+int fluid65_get_param(const fluid65_sim* sim, fluid65_param param, float* value) {
+    const float* source = parameter(param);
+    if (!sim || sim != liveSimulation || !source || !value) return FLUID65_ERROR_INVALID_ARGUMENT;
+    *value = *source;
+    return FLUID65_OK;
+}
+
+int fluid65_get_positions(const fluid65_sim* sim, float* out, int capacity) {
+    return copyOut(sim, out, capacity, offsetof(Particle, position), 3);
+}
+
+int fluid65_get_velocities(const fluid65_sim* sim, float* out, int capacity) {
+    return copyOut(sim, out, capacity, offsetof(Particle, velocity), 3);
+}
+
+int fluid65_get_densities(const fluid65_sim* sim, float* out, int capacity) {
+    return copyOut(sim, out, capacity, offsetof(Particle, density), 1);
+}
+
+int fluid65_query_particles(fluid65_sim* sim, const float* points, int count, float radius, int* start, int* index, int capacity) {
+    if (!sim || sim != liveSimulation || count < 0 || (count > 0 && !points) || !start || !(radius >= 0.0f) || capacity < 0 || (capacity > 0 && !index)) {
+        return FLUID65_ERROR_INVALID_ARGUMENT;
+    }
+    try {
+        queryParticles(queryResults, (const Vector3*)points, count, 3*sizeof(float), radius);
+    } catch (const std::bad_alloc&) {
+        return FLUID65_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return FLUID65_ERROR_INTERNAL;
+    }
+    for (int q = 0; q <= count; q++) start[q] = queryResults.start[q];
+    const int total = queryResults.start[count];
+    if (capacity < total) return FLUID65_ERROR_BUFFER_TOO_SMALL;
+    for (int k = 0; k < total; k++) index[k] = queryResults.index[k];
+    return total;
+}
@@ -0,0 +1,119 @@
+#include "forcefields.h"
+
+#include <cmath>
+
+std::vector<ForceField> forceFields;
+
+static ForceField makeField(ForceFieldType type, Vector3 center, Vector3 direction, float strength, float radius) {
+    ForceField field;
+    field.type = type;
+    field.center = center;
+    field.direction = Vector3Normalize(direction);
+    field.strength = strength;
+    field.radius = radius;
+    field.frequency = 0.0f;
+    field.phase = 0.0f;
+    return field;
+}
+
+ForceField uniformField(Vector3 direction, float strength) {
+    return makeField(FORCE_UNIFORM, Vector3Zero(), direction, strength, 0.0f);
+}
+
+ForceField radialField(Vector3 center, float strength, float radius) {
+    return makeField(FORCE_RADIAL, center, Vector3Zero(), strength, radius);
+}
+
+ForceField vortexField(Vector3 center, Vector3 axis, float strength, float radius) {
+    return makeField(FORCE_VORTEX, center, axis, strength, radius);
+}
+
+ForceField curlNoiseField(float strength, float frequency, float phase) {
+    ForceField field = makeField(FORCE_CURL_NOISE, Vector3Zero(), Vector3Zero(), strength, 0.0f);
+    field.frequency = frequency;
+    field.phase = phase;
+    return field;
+}
+
+ForceField rayField(Vector3 origin, Vector3 direction, float strength, float radius) {
+    return makeField(FORCE_RAY, origin, direction, strength, radius);
+}
+
+static inline const Vector3& positionAt(const Vector3* positions, size_t stride, int i) {
+    return *(const Vector3*)((const char*)positions + stride*i);
+}
+
+// 1 at distance 0 down to 0 at the radius; inverseRadius 0 means no falloff
+static inline float falloff(float distance, float inverseRadius) {
+    return fmaxf(0.0f, 1.0f - distance*inverseRadius);
+}
+
+// curl of the potential (sin(fy+a)cos(fz+b), sin(fz+c)cos(fx+d), sin(fx+e)cos(fy+g)),
+// divided by f so strength is the amplitude
+static inline Vector3 curlNoise(Vector3 p, float f, float phase) {
+    const float a = phase, b = 1.3f + 0.7f*phase, c = 2.1f - phase, d = 0.4f + 1.1f*phase, e = 3.3f + 0.9f*phase, g = 5.2f - 0.6f*phase;
+    const float fx = f*p.x, fy = f*p.y, fz = f*p.z;
+    const float dCdy = -sinf(fx + e)*sinf(fy + g);
+    const float dBdz = cosf(fz + c)*cosf(fx + d);
+    const float dAdz = -sinf(fy + a)*sinf(fz + b);
+    const float dCdx = cosf(fx + e)*cosf(fy + g);
+    const float dBdx = -sinf(fz + c)*sinf(fx + d);
+    const float dAdy = cosf(fy + a)*cosf(fz + b);
+    return {dCdy - dBdz, dAdz - dCdx, dBdx - dAdy};
+}
+
+void applyForceFields(const std::vector<ForceField>& fields, const Vector3* positions, int count, size_t stride, Vector3* accelerations) {
+    for (const ForceField& field : fields) {
+        const float inverseRadius = field.radius > 0.0f ? 1.0f/field.radius : 0.0f;
+        const Vector3 c = field.center, axis = field.direction;
+        const float s = field.strength;
+
+        switch (field.type) {
+            case FORCE_UNIFORM: {
+                const Vector3 a = Vector3Scale(axis, s);
+                #pragma omp parallel for schedule(static)
+                for (int i = 0; i < count; i++) accelerations[i] = Vector3Add(accelerations[i], a);
+                break;
+            }
+            case FORCE_RADIAL: {
+                #pragma omp parallel for schedule(static)
+                for (int i = 0; i < count; i++) {
+                    const Vector3 r = Vector3Subtract(positionAt(positions, stride, i), c);
+                    const float d = Vector3Length(r);
+                    accelerations[i] = Vector3Add(accelerations[i], Vector3Scale(Vector3Normalize(r), s*falloff(d, inverseRadius)));
+                }
+                break;
+            }
+            case FORCE_VORTEX: {
+                #pragma omp parallel for schedule(static)
+                for (int i = 0; i < count; i++) {
+                    const Vector3 r = Vector3Subtract(positionAt(positions, stride, i), c);
+                    const Vector3 tangent = Vector3CrossProduct(axis, r);
+                    const float d = Vector3Length(tangent);     // |axis x r| is the distance to the axis
+                    accelerations[i] = Vector3Add(accelerations[i], Vector3Scale(Vector3Normalize(tangent), s*falloff(d, inverseRadius)));
+                }
+                break;
+            }
+            case FORCE_CURL_NOISE: {
+                #pragma omp parallel for schedule(static)
+                for (int i = 0; i < count; i++) {
+                    const Vector3 n = curlNoise(positionAt(positions, stride, i), field.frequency, field.phase);
+                    accelerations[i] = Vector3Add(accelerations[i], Vector3Scale(n, s));
+                }
+                break;
+            }
+            case FORCE_RAY: {
+                #pragma omp parallel for schedule(static)
+                for (int i = 0; i < count; i++) {
+                    const Vector3 r = Vector3Subtract(positionAt(positions, stride, i), c);
+                    const float along = Vector3DotProduct(r, axis);
+                    const float d = Vector3Length(Vector3Subtract(r, Vector3Scale(axis, along)));
+                    // only ahead of the origin
+                    const float weight = (along > 0.0f)*falloff(d, inverseRadius);
+                    accelerations[i] = Vector3Add(accelerations[i], Vector3Scale(axis, s*weight));
+                }
+                break;
+            }
+        }
+    }
+}
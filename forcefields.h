@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <raymath.h>
+#include <vector>
+
+enum ForceFieldType {
+    FORCE_UNIFORM,      // strength along direction everywhere
+    FORCE_RADIAL,       // away from center (negative strength pulls in)
+    FORCE_VORTEX,       // around the axis through center along direction
+    FORCE_CURL_NOISE,   // divergence-free swirling noise, animated by phase
+    FORCE_RAY           // along direction, for particles near the ray from center
+};
+
+// one entry in the field list; every field is an acceleration (force per unit mass)
+struct ForceField {
+    ForceFieldType type;
+    Vector3 center;
+    Vector3 direction;  // unit length
+    float strength;
+    float radius;       // linear falloff to 0 at radius (distance to the axis/ray for vortex/ray), 0 = no falloff
+    float frequency;    // curl noise spatial frequency
+    float phase;        // curl noise offset, advance it to animate
+};
+
+ForceField uniformField(Vector3 direction, float strength);
+ForceField radialField(Vector3 center, float strength, float radius);
+ForceField vortexField(Vector3 center, Vector3 axis, float strength, float radius);
+ForceField curlNoiseField(float strength, float frequency, float phase);
+ForceField rayField(Vector3 origin, Vector3 direction, float strength, float radius);
+
+// extra fields applied on top of gravity every step
+extern std::vector<ForceField> forceFields;
+
+// adds every field's acceleration at count positions (stride bytes apart) to
+// accelerations, one field at a time so each inner loop is a single formula
+void applyForceFields(const std::vector<ForceField>& fields, const Vector3* positions, int count, size_t stride, Vector3* accelerations);
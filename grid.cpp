@@ -0,0 +1,592 @@
+#include "grid.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+
+// keeps a few far-flung particles from allocating a huge mostly empty grid
+static const long long maxCellsPerPoint = 8;
+static const long long minCellLimit = 1 << 20;
+
+static inline const Vector3& positionAt(const Vector3* positions, size_t stride, int i) {
+    return *(const Vector3*)((const char*)positions + stride*i);
+}
+
+static inline int cellCoord(float x, float origin, float cellSize, int dim) {
+    int c = (int)((x - origin)/cellSize);
+    return c < 0 ? 0 : (c >= dim ? dim - 1 : c);
+}
+
+void buildGrid(UniformGrid& grid, const Vector3* positions, int count, size_t stride, float cellSize, int slack) {
+    Vector3 lo = {0.0f, 0.0f, 0.0f}, hi = {0.0f, 0.0f, 0.0f};
+    if (count > 0) lo = hi = positionAt(positions, stride, 0);
+    for (int i = 1; i < count; i++) {
+        lo = Vector3Min(lo, positionAt(positions, stride, i));
+        hi = Vector3Max(hi, positionAt(positions, stride, i));
+    }
+    if (slack > 0) {
+        lo = Vector3SubtractValue(lo, cellSize);
+        hi = Vector3AddValue(hi, cellSize);
+    }
+
+    long long limit = maxCellsPerPoint*count;
+    if (limit < minCellLimit) limit = minCellLimit;
+    long long cells;
+    while (true) {
+        grid.dims[0] = (int)((hi.x - lo.x)/cellSize) + 1;
+        grid.dims[1] = (int)((hi.y - lo.y)/cellSize) + 1;
+        grid.dims[2] = (int)((hi.z - lo.z)/cellSize) + 1;
+        cells = (long long)grid.dims[0]*grid.dims[1]*grid.dims[2];
+        if (cells <= limit) break;
+        cellSize *= 2.0f;
+    }
+    grid.origin = lo;
+    grid.cellSize = cellSize;
+    grid.slack = slack > 0 ? slack : 0;
+    grid.moved = 0;
+
+    grid.cellStart.resize(cells + 1);
+    grid.cellCount.assign(cells, 0);
+    grid.pointCell.resize(count);
+    grid.pointSlot.resize(count);
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < count; i++) {
+        const Vector3& p = positionAt(positions, stride, i);
+        int cx = cellCoord(p.x, lo.x, cellSize, grid.dims[0]);
+        int cy = cellCoord(p.y, lo.y, cellSize, grid.dims[1]);
+        int cz = cellCoord(p.z, lo.z, cellSize, grid.dims[2]);
+        grid.pointCell[i] = (cz*grid.dims[1] + cy)*grid.dims[0] + cx;
+    }
+
+    for (int i = 0; i < count; i++) grid.cellCount[grid.pointCell[i]]++;
+    grid.cellStart[0] = 0;
+    for (long long c = 0; c < cells; c++) grid.cellStart[c + 1] = grid.cellStart[c] + grid.cellCount[c] + (grid.slack ? grid.slack + grid.cellCount[c]/2 : 0);
+    grid.cellPoints.assign(grid.cellStart[cells], -1);
+    std::vector<int> fill(grid.cellStart.begin(), grid.cellStart.end() - 1);
+    for (int i = 0; i < count; i++) {
+        const int slot = fill[grid.pointCell[i]]++;
+        grid.cellPoints[slot] = i;
+        grid.pointSlot[i] = slot;
+    }
+}
+
+int gridCell(const UniformGrid& grid, Vector3 p) {
+    const float x = (p.x - grid.origin.x)/grid.cellSize, y = (p.y - grid.origin.y)/grid.cellSize, z = (p.z - grid.origin.z)/grid.cellSize;
+    // written so NaN fails too
+    if (!(x >= 0.0f && y >= 0.0f && z >= 0.0f && x < grid.dims[0] && y < grid.dims[1] && z < grid.dims[2])) return -1;
+    return ((int)z*grid.dims[1] + (int)y)*grid.dims[0] + (int)x;
+}
+
+bool updateGrid(UniformGrid& grid, const Vector3* positions, size_t stride, const std::vector<int>& movers, float maxMovedFraction) {
+    const int count = (int)grid.pointCell.size();
+    if (grid.slack <= 0 || grid.moved + (double)movers.size() > (double)maxMovedFraction*count) return false;
+
+    for (int i : movers) {
+        const int from = grid.pointCell[i];
+        const int to = gridCell(grid, positionAt(positions, stride, i));
+        if (to == from) continue;
+        if (to < 0 || grid.cellCount[to] == grid.cellStart[to + 1] - grid.cellStart[to]) return false;
+
+        // the old cell's last point fills the gap, so each cell stays packed at the front
+        const int last = grid.cellStart[from] + --grid.cellCount[from];
+        const int other = grid.cellPoints[last];
+        grid.cellPoints[grid.pointSlot[i]] = other;
+        grid.pointSlot[other] = grid.pointSlot[i];
+        grid.cellPoints[last] = -1;
+
+        const int slot = grid.cellStart[to] + grid.cellCount[to]++;
+        grid.cellPoints[slot] = i;
+        grid.pointSlot[i] = slot;
+        grid.pointCell[i] = to;
+    }
+    grid.moved += (int)movers.size();
+    return true;
+}
+
+// visits every grid point other than exclude in the 27 cells around p that lies within radius
+template <typename Visit>
+static inline void forEachPointNear(const UniformGrid& grid, const Vector3* positions, size_t stride, Vector3 p, int exclude, float radius2, Visit visit) {
+    const int cx = cellCoord(p.x, grid.origin.x, grid.cellSize, grid.dims[0]);
+    const int cy = cellCoord(p.y, grid.origin.y, grid.cellSize, grid.dims[1]);
+    const int cz = cellCoord(p.z, grid.origin.z, grid.cellSize, grid.dims[2]);
+    for (int z = cz > 0 ? cz - 1 : 0; z <= cz + 1 && z < grid.dims[2]; z++) {
+        for (int y = cy > 0 ? cy - 1 : 0; y <= cy + 1 && y < grid.dims[1]; y++) {
+            const int row = (z*grid.dims[1] + y)*grid.dims[0];
+            const int first = grid.cellStart[row + (cx > 0 ? cx - 1 : 0)];
+            const int last = grid.cellStart[row + (cx + 1 < grid.dims[0] ? cx + 1 : cx) + 1];
+            // the x-neighbor cells of one row are contiguous in cellPoints, slack included
+            for (int k = first; k < last; k++) {
+                const int j = grid.cellPoints[k];
+                if (j >= 0 && j != exclude && Vector3DistanceSqr(p, positionAt(positions, stride, j)) <= radius2) visit(j);
+            }
+        }
+    }
+}
+
+void buildNeighborList(NeighborList& list, const UniformGrid& grid, const Vector3* positions, int count, size_t stride, float radius) {
+    const float radius2 = radius*radius;
+    list.start.assign(count + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        int n = 0;
+        forEachPointNear(grid, positions, stride, positionAt(positions, stride, i), i, radius2, [&n](int) { n++; });
+        list.start[i + 1] = n;
+    }
+    for (int i = 0; i < count; i++) list.start[i + 1] += list.start[i];
+
+    list.index.resize(list.start[count]);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        int* out = list.index.data() + list.start[i];
+        forEachPointNear(grid, positions, stride, positionAt(positions, stride, i), i, radius2, [&out](int j) { *out++ = j; });
+    }
+}
+
+// edge cells are clamped, so points far outside the grid must be rejected before the lookup
+static inline bool nearGrid(const UniformGrid& grid, Vector3 p, float radius) {
+    const float sx = grid.dims[0]*grid.cellSize, sy = grid.dims[1]*grid.cellSize, sz = grid.dims[2]*grid.cellSize;
+    return p.x >= grid.origin.x - radius && p.x <= grid.origin.x + sx + radius &&
+           p.y >= grid.origin.y - radius && p.y <= grid.origin.y + sy + radius &&
+           p.z >= grid.origin.z - radius && p.z <= grid.origin.z + sz + radius;
+}
+
+// visits every grid point within radius of p, looking through all cells within reach
+// (at least radius) of p, however many that is
+template <typename Visit>
+static inline void forEachPointWithin(const UniformGrid& grid, const Vector3* positions, size_t stride, Vector3 p, float reach, float radius2, Visit visit) {
+    const int x0 = cellCoord(p.x - reach, grid.origin.x, grid.cellSize, grid.dims[0]);
+    const int x1 = cellCoord(p.x + reach, grid.origin.x, grid.cellSize, grid.dims[0]);
+    const int y0 = cellCoord(p.y - reach, grid.origin.y, grid.cellSize, grid.dims[1]);
+    const int y1 = cellCoord(p.y + reach, grid.origin.y, grid.cellSize, grid.dims[1]);
+    const int z0 = cellCoord(p.z - reach, grid.origin.z, grid.cellSize, grid.dims[2]);
+    const int z1 = cellCoord(p.z + reach, grid.origin.z, grid.cellSize, grid.dims[2]);
+    for (int z = z0; z <= z1; z++) {
+        for (int y = y0; y <= y1; y++) {
+            const int row = (z*grid.dims[1] + y)*grid.dims[0];
+            for (int k = grid.cellStart[row + x0]; k < grid.cellStart[row + x1 + 1]; k++) {
+                const int j = grid.cellPoints[k];
+                if (j >= 0 && Vector3DistanceSqr(p, positionAt(positions, stride, j)) <= radius2) visit(j);
+            }
+        }
+    }
+}
+
+void buildCrossNeighborList(NeighborList& list, const UniformGrid& grid, const Vector3* gridPositions, size_t gridStride,
+                            const Vector3* queries, int count, size_t queryStride, float radius, float margin) {
+    const float radius2 = radius*radius;
+    const float reach = radius + margin;
+    const bool empty = grid.pointCell.empty();
+    list.start.assign(count + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        const Vector3 p = positionAt(queries, queryStride, i);
+        if (empty || !nearGrid(grid, p, reach)) continue;
+        int n = 0;
+        forEachPointWithin(grid, gridPositions, gridStride, p, reach, radius2, [&n](int) { n++; });
+        list.start[i + 1] = n;
+    }
+    for (int i = 0; i < count; i++) list.start[i + 1] += list.start[i];
+
+    list.index.resize(list.start[count]);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        if (list.start[i + 1] == list.start[i]) continue;
+        int* out = list.index.data() + list.start[i];
+        forEachPointWithin(grid, gridPositions, gridStride, positionAt(queries, queryStride, i), reach, radius2, [&out](int j) { *out++ = j; });
+    }
+}
+
+static const int sparseBlockBits = 2;   // 4 cells per block edge
+static const int sparseBlockCells = 1 << (3*sparseBlockBits);
+static const int sparseCoordBias = 1 << 20;
+
+static inline int sparseCell(float x, float cellSize) {
+    float c = floorf(x/cellSize);
+    // far-off or non-finite points share the outermost cells instead of overflowing
+    const float limit = (float)(sparseCoordBias << sparseBlockBits) - 1.0f;
+    return (int)(c > -limit ? (c < limit ? c : limit) : -limit);
+}
+
+// 21 bits per block coordinate
+static inline unsigned long long sparseBlockKey(int cx, int cy, int cz) {
+    const unsigned long long mask = (1ULL << 21) - 1;
+    unsigned long long bx = (unsigned long long)((cx >> sparseBlockBits) + sparseCoordBias) & mask;
+    unsigned long long by = (unsigned long long)((cy >> sparseBlockBits) + sparseCoordBias) & mask;
+    unsigned long long bz = (unsigned long long)((cz >> sparseBlockBits) + sparseCoordBias) & mask;
+    return (bz << 42) | (by << 21) | bx;
+}
+
+static inline int sparseLocalCell(int cx, int cy, int cz) {
+    const int mask = (1 << sparseBlockBits) - 1;
+    return (((cz & mask) << sparseBlockBits | (cy & mask)) << sparseBlockBits) | (cx & mask);
+}
+
+static inline size_t sparseSlot(unsigned long long key, size_t mask) {
+    return (size_t)((key*0x9e3779b97f4a7c15ULL) >> 32) & mask;
+}
+
+// block holding the key, -1 if there is none
+static inline int findSparseBlock(const SparseGrid& grid, unsigned long long key) {
+    const size_t mask = grid.slotKey.size() - 1;
+    for (size_t s = sparseSlot(key, mask); ; s = (s + 1) & mask) {
+        if (grid.slotKey[s] == key) return grid.slotBlock[s];
+        if (grid.slotKey[s] == sparseEmptyKey) return -1;
+    }
+}
+
+void buildSparseGrid(SparseGrid& grid, const Vector3* positions, int count, size_t stride, float cellSize) {
+    grid.cellSize = cellSize;
+    size_t capacity = 16;
+    while (capacity < 2*(size_t)count) capacity *= 2;
+    const size_t mask = capacity - 1;
+
+    // blocks are claimed concurrently with a compare-and-swap on the free slot
+    std::unique_ptr<std::atomic<unsigned long long>[]> slots(new std::atomic<unsigned long long>[capacity]);
+    for (size_t s = 0; s < capacity; s++) slots[s].store(sparseEmptyKey, std::memory_order_relaxed);
+    std::vector<int> pointSlot(count), pointLocal(count);
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < count; i++) {
+        const Vector3& p = positionAt(positions, stride, i);
+        int cx = sparseCell(p.x, cellSize), cy = sparseCell(p.y, cellSize), cz = sparseCell(p.z, cellSize);
+        unsigned long long key = sparseBlockKey(cx, cy, cz);
+        size_t s = sparseSlot(key, mask);
+        while (true) {
+            unsigned long long expected = sparseEmptyKey;
+            if (slots[s].compare_exchange_strong(expected, key, std::memory_order_relaxed) || expected == key) break;
+            s = (s + 1) & mask;
+        }
+        pointSlot[i] = (int)s;
+        pointLocal[i] = sparseLocalCell(cx, cy, cz);
+    }
+
+    grid.slotKey.resize(capacity);
+    grid.slotBlock.resize(capacity);
+    grid.blockCount = 0;
+    for (size_t s = 0; s < capacity; s++) {
+        grid.slotKey[s] = slots[s].load(std::memory_order_relaxed);
+        grid.slotBlock[s] = grid.slotKey[s] == sparseEmptyKey ? -1 : grid.blockCount++;
+    }
+
+    // counting sort by cell, stable in point index so the lists do not depend on the thread count
+    const size_t cells = (size_t)grid.blockCount*sparseBlockCells;
+    grid.cellStart.assign(cells + 1, 0);
+    grid.cellPoints.resize(count);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < count; i++) pointLocal[i] += grid.slotBlock[pointSlot[i]]*sparseBlockCells;
+    for (int i = 0; i < count; i++) grid.cellStart[pointLocal[i] + 1]++;
+    for (size_t c = 0; c < cells; c++) grid.cellStart[c + 1] += grid.cellStart[c];
+    std::vector<int> fill(grid.cellStart.begin(), grid.cellStart.end() - 1);
+    for (int i = 0; i < count; i++) grid.cellPoints[fill[pointLocal[i]]++] = i;
+}
+
+template <typename Visit>
+static inline void forEachPointNear(const SparseGrid& grid, const Vector3* positions, size_t stride, Vector3 p, int exclude, float radius2, Visit visit) {
+    const int cx = sparseCell(p.x, grid.cellSize), cy = sparseCell(p.y, grid.cellSize), cz = sparseCell(p.z, grid.cellSize);
+    for (int z = cz - 1; z <= cz + 1; z++) {
+        for (int y = cy - 1; y <= cy + 1; y++) {
+            // the three cells of a row span at most two blocks, so remember the last one
+            unsigned long long lastKey = sparseEmptyKey;
+            int block = -1;
+            for (int x = cx - 1; x <= cx + 1; x++) {
+                unsigned long long key = sparseBlockKey(x, y, z);
+                if (key != lastKey) {
+                    block = findSparseBlock(grid, key);
+                    lastKey = key;
+                }
+                if (block < 0) continue;
+                const int c = block*sparseBlockCells + sparseLocalCell(x, y, z);
+                for (int k = grid.cellStart[c]; k < grid.cellStart[c + 1]; k++) {
+                    const int j = grid.cellPoints[k];
+                    if (j != exclude && Vector3DistanceSqr(p, positionAt(positions, stride, j)) <= radius2) visit(j);
+                }
+            }
+        }
+    }
+}
+
+void buildNeighborList(NeighborList& list, const SparseGrid& grid, const Vector3* positions, int count, size_t stride, float radius) {
+    const float radius2 = radius*radius;
+    list.start.assign(count + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        int n = 0;
+        forEachPointNear(grid, positions, stride, positionAt(positions, stride, i), i, radius2, [&n](int) { n++; });
+        list.start[i + 1] = n;
+    }
+    for (int i = 0; i < count; i++) list.start[i + 1] += list.start[i];
+
+    list.index.resize(list.start[count]);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        int* out = list.index.data() + list.start[i];
+        forEachPointNear(grid, positions, stride, positionAt(positions, stride, i), i, radius2, [&out](int j) { *out++ = j; });
+    }
+}
+
+template <typename Visit>
+static inline void forEachPointWithin(const SparseGrid& grid, const Vector3* positions, size_t stride, Vector3 p, float reach, float radius2, Visit visit) {
+    const int x0 = sparseCell(p.x - reach, grid.cellSize), x1 = sparseCell(p.x + reach, grid.cellSize);
+    const int y0 = sparseCell(p.y - reach, grid.cellSize), y1 = sparseCell(p.y + reach, grid.cellSize);
+    const int z0 = sparseCell(p.z - reach, grid.cellSize), z1 = sparseCell(p.z + reach, grid.cellSize);
+    for (int z = z0; z <= z1; z++) {
+        for (int y = y0; y <= y1; y++) {
+            unsigned long long lastKey = sparseEmptyKey;
+            int block = -1;
+            for (int x = x0; x <= x1; x++) {
+                unsigned long long key = sparseBlockKey(x, y, z);
+                if (key != lastKey) {
+                    block = findSparseBlock(grid, key);
+                    lastKey = key;
+                }
+                if (block < 0) continue;
+                const int c = block*sparseBlockCells + sparseLocalCell(x, y, z);
+                for (int k = grid.cellStart[c]; k < grid.cellStart[c + 1]; k++) {
+                    const int j = grid.cellPoints[k];
+                    if (Vector3DistanceSqr(p, positionAt(positions, stride, j)) <= radius2) visit(j);
+                }
+            }
+        }
+    }
+}
+
+void buildCrossNeighborList(NeighborList& list, const SparseGrid& grid, const Vector3* gridPositions, size_t gridStride,
+                            const Vector3* queries, int count, size_t queryStride, float radius, float margin) {
+    const float radius2 = radius*radius;
+    const float reach = radius + margin;
+    const bool empty = grid.blockCount == 0;
+    list.start.assign(count + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        if (empty) continue;
+        int n = 0;
+        forEachPointWithin(grid, gridPositions, gridStride, positionAt(queries, queryStride, i), reach, radius2, [&n](int) { n++; });
+        list.start[i + 1] = n;
+    }
+    for (int i = 0; i < count; i++) list.start[i + 1] += list.start[i];
+
+    list.index.resize(list.start[count]);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        if (list.start[i + 1] == list.start[i]) continue;
+        int* out = list.index.data() + list.start[i];
+        forEachPointWithin(grid, gridPositions, gridStride, positionAt(queries, queryStride, i), reach, radius2, [&out](int j) { *out++ = j; });
+    }
+}
+
+// 3 floats * 256 positions per j-block, well inside L1
+static const int bruteForceBlock = 256;
+
+void buildNeighborListBruteForce(NeighborList& list, const Vector3* positions, int count, size_t stride, float radius) {
+    const float radius2 = radius*radius;
+    std::vector<float> xs(count), ys(count), zs(count);
+    for (int i = 0; i < count; i++) {
+        const Vector3& p = positionAt(positions, stride, i);
+        xs[i] = p.x;
+        ys[i] = p.y;
+        zs[i] = p.z;
+    }
+
+    const int blocks = (count + bruteForceBlock - 1)/bruteForceBlock;
+    std::vector<std::vector<int> > blockIndex(blocks);
+    list.start.assign(count + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < blocks; b++) {
+        const int iFirst = b*bruteForceBlock;
+        const int iLast = iFirst + bruteForceBlock < count ? iFirst + bruteForceBlock : count;
+        std::vector<int>& out = blockIndex[b];
+        std::vector<std::vector<int> > perPoint(iLast - iFirst);
+        float distance2[bruteForceBlock];
+        int found[bruteForceBlock];
+
+        for (int jFirst = 0; jFirst < count; jFirst += bruteForceBlock) {
+            const int jLast = jFirst + bruteForceBlock < count ? jFirst + bruteForceBlock : count;
+            for (int i = iFirst; i < iLast; i++) {
+                const float x = xs[i], y = ys[i], z = zs[i];
+                #pragma omp simd
+                for (int j = jFirst; j < jLast; j++) {
+                    const float dx = xs[j] - x, dy = ys[j] - y, dz = zs[j] - z;
+                    distance2[j - jFirst] = dx*dx + dy*dy + dz*dz;
+                }
+                // branch-free compaction: always store, advance only on a hit
+                int n = 0;
+                for (int j = jFirst; j < jLast; j++) {
+                    found[n] = j;
+                    n += (distance2[j - jFirst] <= radius2) & (j != i);
+                }
+                perPoint[i - iFirst].insert(perPoint[i - iFirst].end(), found, found + n);
+            }
+        }
+
+        for (int i = iFirst; i < iLast; i++) {
+            list.start[i + 1] = (int)perPoint[i - iFirst].size();
+            out.insert(out.end(), perPoint[i - iFirst].begin(), perPoint[i - iFirst].end());
+        }
+    }
+
+    for (int i = 0; i < count; i++) list.start[i + 1] += list.start[i];
+    list.index.resize(list.start[count]);
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < blocks; b++) {
+        std::copy(blockIndex[b].begin(), blockIndex[b].end(), list.index.begin() + list.start[b*bruteForceBlock]);
+    }
+}
+
+static inline int gridLevel(float radius, float minRadius) {
+    int level = 0;
+    while (level + 1 < maxGridLevels && radius > minRadius*(float)(1 << level)) level++;
+    return level;
+}
+
+void buildMultiLevelGrid(MultiLevelGrid& grid, const Vector3* positions, const float* radii, int count, size_t stride) {
+    float minRadius = 0.0f;
+    for (int i = 0; i < count; i++) {
+        if (radii[i] > 0.0f && (minRadius == 0.0f || radii[i] < minRadius)) minRadius = radii[i];
+    }
+    grid.minRadius = minRadius > 0.0f ? minRadius : 1.0f;
+
+    int levels = 0;
+    std::vector<int> pointLevel(count);
+    for (int i = 0; i < count; i++) {
+        pointLevel[i] = gridLevel(radii[i], grid.minRadius);
+        if (pointLevel[i] + 1 > levels) levels = pointLevel[i] + 1;
+    }
+
+    grid.levels.resize(levels);
+    grid.levelPositions.resize(levels);
+    grid.levelPoints.resize(levels);
+    for (int l = 0; l < levels; l++) {
+        grid.levelPositions[l].clear();
+        grid.levelPoints[l].clear();
+    }
+    for (int i = 0; i < count; i++) {
+        grid.levelPositions[pointLevel[i]].push_back(positionAt(positions, stride, i));
+        grid.levelPoints[pointLevel[i]].push_back(i);
+    }
+    for (int l = 0; l < levels; l++) {
+        const std::vector<Vector3>& level = grid.levelPositions[l];
+        buildGrid(grid.levels[l], level.data(), (int)level.size(), sizeof(Vector3), grid.minRadius*(float)(1 << l), 0);
+    }
+}
+
+// visits the points of level l within max(radius, their own radius) of p, over
+// however many cells that spans
+template <typename Visit>
+static inline void forEachLevelPointNear(const MultiLevelGrid& grid, int l, const float* radii, Vector3 p, float radius, int exclude, Visit visit) {
+    const UniformGrid& level = grid.levels[l];
+    if (grid.levelPoints[l].empty()) return;
+    const float reach = fmaxf(radius, grid.minRadius*(float)(1 << l));
+    if (!nearGrid(level, p, reach)) return;
+
+    const int x0 = cellCoord(p.x - reach, level.origin.x, level.cellSize, level.dims[0]);
+    const int x1 = cellCoord(p.x + reach, level.origin.x, level.cellSize, level.dims[0]);
+    const int y0 = cellCoord(p.y - reach, level.origin.y, level.cellSize, level.dims[1]);
+    const int y1 = cellCoord(p.y + reach, level.origin.y, level.cellSize, level.dims[1]);
+    const int z0 = cellCoord(p.z - reach, level.origin.z, level.cellSize, level.dims[2]);
+    const int z1 = cellCoord(p.z + reach, level.origin.z, level.cellSize, level.dims[2]);
+    const Vector3* positions = grid.levelPositions[l].data();
+    const int* points = grid.levelPoints[l].data();
+    for (int z = z0; z <= z1; z++) {
+        for (int y = y0; y <= y1; y++) {
+            const int row = (z*level.dims[1] + y)*level.dims[0];
+            for (int k = level.cellStart[row + x0]; k < level.cellStart[row + x1 + 1]; k++) {
+                const int j = points[level.cellPoints[k]];
+                if (j == exclude) continue;
+                const float r = fmaxf(radius, radii[j]);
+                if (Vector3DistanceSqr(p, positions[level.cellPoints[k]]) <= r*r) visit(j);
+            }
+        }
+    }
+}
+
+void buildNeighborList(NeighborList& list, const MultiLevelGrid& grid, const Vector3* positions, const float* radii, int count, size_t stride) {
+    const int levels = (int)grid.levels.size();
+    list.start.assign(count + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        const Vector3 p = positionAt(positions, stride, i);
+        int n = 0;
+        for (int l = 0; l < levels; l++) forEachLevelPointNear(grid, l, radii, p, radii[i], i, [&n](int) { n++; });
+        list.start[i + 1] = n;
+    }
+    for (int i = 0; i < count; i++) list.start[i + 1] += list.start[i];
+
+    list.index.resize(list.start[count]);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        const Vector3 p = positionAt(positions, stride, i);
+        int* out = list.index.data() + list.start[i];
+        for (int l = 0; l < levels; l++) forEachLevelPointNear(grid, l, radii, p, radii[i], i, [&out](int j) { *out++ = j; });
+    }
+}
+
+void buildTiles(TileSet& tiles, const UniformGrid& grid, int cellsPerTile) {
+    if (cellsPerTile < 1) cellsPerTile = 1;
+    int tileDims[3];
+    for (int a = 0; a < 3; a++) tileDims[a] = (grid.dims[a] + cellsPerTile - 1)/cellsPerTile;
+    const int denseTiles = tileDims[0]*tileDims[1]*tileDims[2];
+
+    // dense tile index -> compact index of a non-empty tile, -1 if empty
+    std::vector<int> compact(denseTiles, -1);
+    std::vector<int> denseOf;
+    std::vector<int> tileCount;
+    for (int z = 0; z < grid.dims[2]; z++) {
+        for (int y = 0; y < grid.dims[1]; y++) {
+            for (int x = 0; x < grid.dims[0]; x++) {
+                int c = (z*grid.dims[1] + y)*grid.dims[0] + x;
+                int n = grid.cellCount[c];
+                if (n == 0) continue;
+                int dense = ((z/cellsPerTile)*tileDims[1] + y/cellsPerTile)*tileDims[0] + x/cellsPerTile;
+                if (compact[dense] < 0) {
+                    compact[dense] = (int)denseOf.size();
+                    denseOf.push_back(dense);
+                    tileCount.push_back(0);
+                }
+                tileCount[compact[dense]] += n;
+            }
+        }
+    }
+
+    const int count = (int)denseOf.size();
+    tiles.pointStart.assign(count + 1, 0);
+    for (int t = 0; t < count; t++) tiles.pointStart[t + 1] = tiles.pointStart[t] + tileCount[t];
+    tiles.points.resize(tiles.pointStart[count]);
+    std::vector<int> fill(tiles.pointStart.begin(), tiles.pointStart.end() - 1);
+    for (int z = 0; z < grid.dims[2]; z++) {
+        for (int y = 0; y < grid.dims[1]; y++) {
+            for (int x = 0; x < grid.dims[0]; x++) {
+                int c = (z*grid.dims[1] + y)*grid.dims[0] + x;
+                if (grid.cellCount[c] == 0) continue;
+                int t = compact[((z/cellsPerTile)*tileDims[1] + y/cellsPerTile)*tileDims[0] + x/cellsPerTile];
+                for (int k = grid.cellStart[c]; k < grid.cellStart[c] + grid.cellCount[c]; k++) tiles.points[fill[t]++] = grid.cellPoints[k];
+            }
+        }
+    }
+
+    tiles.neighborStart.assign(count + 1, 0);
+    tiles.neighbors.clear();
+    for (int t = 0; t < count; t++) {
+        int dense = denseOf[t];
+        int tx = dense % tileDims[0];
+        int ty = (dense/tileDims[0]) % tileDims[1];
+        int tz = dense/(tileDims[0]*tileDims[1]);
+        for (int z = tz - 1; z <= tz + 1; z++) {
+            for (int y = ty - 1; y <= ty + 1; y++) {
+                for (int x = tx - 1; x <= tx + 1; x++) {
+                    if (x < 0 || y < 0 || z < 0 || x >= tileDims[0] || y >= tileDims[1] || z >= tileDims[2]) continue;
+                    int n = compact[(z*tileDims[1] + y)*tileDims[0] + x];
+                    if (n >= 0) tiles.neighbors.push_back(n);
+                }
+            }
+        }
+        tiles.neighborStart[t + 1] = (int)tiles.neighbors.size();
+    }
+}
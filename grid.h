@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <raymath.h>
+#include <vector>
+
+// dense uniform grid over the bounding box of a point set, built from scratch
+// by a counting sort. Cells are at least cellSize wide, so every point within
+// cellSize of p is in the 27 cells around p's cell.
+//
+// Built with slack, every cell keeps slack plus half its count free slots (-1)
+// after its points and the box gets a margin of one cell, so updateGrid can move the few points
+// that changed cell instead of rebuilding.
+struct UniformGrid {
+    Vector3 origin;
+    float cellSize;
+    int dims[3];
+    std::vector<int> cellStart;     // cellStart[c]..cellStart[c+1] indexes cellPoints
+    std::vector<int> cellCount;     // points at the front of that range, the rest is slack
+    std::vector<int> cellPoints;    // point indices sorted by cell, -1 in slack slots
+    std::vector<int> pointCell;
+    std::vector<int> pointSlot;     // where each point sits in cellPoints
+    int slack;
+    int moved;                      // points moved by updateGrid since the build
+};
+
+// neighbors of point i are index[start[i]..start[i+1]), never i itself
+struct NeighborList {
+    std::vector<int> start;
+    std::vector<int> index;
+};
+
+// positions are read as count Vector3s, stride bytes apart
+void buildGrid(UniformGrid& grid, const Vector3* positions, int count, size_t stride, float cellSize, int slack);
+
+// the cell holding p, -1 outside the grid
+int gridCell(const UniformGrid& grid, Vector3 p);
+
+// moves the movers (points whose cell may have changed) to their current cells.
+// False when the grid has no slack, a cell is full, a point left the grid, or
+// more than maxMovedFraction of the points moved since the build; the grid is
+// then stale and has to be rebuilt.
+bool updateGrid(UniformGrid& grid, const Vector3* positions, size_t stride, const std::vector<int>& movers, float maxMovedFraction);
+void buildNeighborList(NeighborList& list, const UniformGrid& grid, const Vector3* positions, int count, size_t stride, float radius);
+
+// for each of count query points, the grid's points (read from gridPositions) within
+// radius. Any radius works; margin widens the cells searched for grid points that
+// have moved up to that far since the grid was built.
+void buildCrossNeighborList(NeighborList& list, const UniformGrid& grid, const Vector3* gridPositions, size_t gridStride,
+                            const Vector3* queries, int count, size_t queryStride, float radius, float margin);
+
+// same list from all pairs, blocked so each j-block of positions stays in L1
+// and the distance test vectorizes across j; cheaper than the grid for small counts
+void buildNeighborListBruteForce(NeighborList& list, const Vector3* positions, int count, size_t stride, float radius);
+
+// hashed grid with no bounds: cells are grouped into blocks of 4^3, and only
+// blocks holding points exist, found through an open-addressing table keyed by
+// block coordinates. Memory follows the point count, however far apart the
+// points are, and a cell lookup is one hash probe sequence.
+struct SparseGrid {
+    float cellSize;
+    std::vector<unsigned long long> slotKey;    // power of two table, sparseEmptyKey when free
+    std::vector<int> slotBlock;
+    std::vector<int> cellStart;     // cell (block*64 + local) -> cellPoints range
+    std::vector<int> cellPoints;
+    int blockCount;
+};
+
+static const unsigned long long sparseEmptyKey = ~0ULL;
+
+// cellSize is used as given; nothing coarsens it since the grid has no extent
+void buildSparseGrid(SparseGrid& grid, const Vector3* positions, int count, size_t stride, float cellSize);
+void buildNeighborList(NeighborList& list, const SparseGrid& grid, const Vector3* positions, int count, size_t stride, float radius);
+void buildCrossNeighborList(NeighborList& list, const SparseGrid& grid, const Vector3* gridPositions, size_t gridStride,
+                            const Vector3* queries, int count, size_t queryStride, float radius, float margin);
+
+// one dense grid per smoothing length octave, for points with their own radius:
+// level l holds the points with radius in (minRadius*2^(l-1), minRadius*2^l] in
+// cells of that size, so fine points are never binned with coarse cells. A
+// pair is neighbors when it is within the larger of the two radii, which makes
+// the list symmetric; each level is searched with max(query radius, level radius).
+struct MultiLevelGrid {
+    float minRadius;
+    std::vector<UniformGrid> levels;
+    std::vector<std::vector<Vector3> > levelPositions;  // the level's points, gathered
+    std::vector<std::vector<int> > levelPoints;         // level index -> point index
+};
+
+static const int maxGridLevels = 16;
+
+// radii are read as count floats; the coarsest level takes every radius above it
+void buildMultiLevelGrid(MultiLevelGrid& grid, const Vector3* positions, const float* radii, int count, size_t stride);
+void buildNeighborList(NeighborList& list, const MultiLevelGrid& grid, const Vector3* positions, const float* radii, int count, size_t stride);
+
+// blocks of cellsPerTile^3 grid cells, used to schedule work by neighborhood.
+// Only tiles that hold points are kept; since cells are at least the query
+// radius wide, a point's neighbors all lie in its own or a touching tile.
+struct TileSet {
+    std::vector<int> pointStart;    // pointStart[t]..pointStart[t+1] indexes points
+    std::vector<int> points;
+    std::vector<int> neighborStart; // neighborStart[t]..neighborStart[t+1] indexes neighbors
+    std::vector<int> neighbors;     // touching non-empty tiles, t itself included
+};
+
+void buildTiles(TileSet& tiles, const UniformGrid& grid, int cellsPerTile);
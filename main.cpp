@@ -1,44 +1,140 @@
 // references: https://matthias-research.github.io/pages/publications/sca03.pdf
 
+#include <algorithm>
+#include <atomic>
 #include <climits>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
 #include <opencv2/videoio.hpp>
-#include <random>
 #include <raylib-cpp.hpp>
 #include <raylib.h>
 #include <raymath.h>
+#include <rlgl.h>
+#include <thread>
 #include <vector>
 #include <opencv2/opencv.hpp>
 
+#include "camerapath.h"
+#include "fluid.h"
+#include "particlecache.h"
+#include "rigidbody.h"
+#include "scenes.h"
+#include "secondary.h"
+#include "triplebuffer.h"
+
 const int screenWidth = 1920;
 const int screenHeight = 1080;
 
 const int numParticles = 1000;
 
-const float sphereSize = 40.0;
-
-const float sampleRadius = 12.0f;
+// what the render thread needs from one simulation step
+struct Snapshot {
+    std::vector<Vector3> positions;
+    std::vector<int> phaseStart;    // particles are grouped by phase
+    std::vector<BodyPose> bodies;
+    std::vector<Vector3> secondaryPositions;
+    std::vector<unsigned char> secondaryTypes;
+    long long step;
+
+    int field;                      // ColorField the values hold, none for COLOR_PHASE
+    std::vector<float> values;
+    float valueMin, valueMax;
+};
 
-const float restDensity = 0.0001f;
+// what the particles are colored by; anything but phase goes through the colormap in frag.glsl
+enum ColorField {
+    COLOR_PHASE,
+    COLOR_SPEED,
+    COLOR_DENSITY,
+    COLOR_PRESSURE,
+    COLOR_NEIGHBORS,
+    COLOR_FIELDS
+};
 
-const float gasConstant = 100.0f;
+const char* const colorFieldNames[COLOR_FIELDS] = { "phase", "speed", "density", "pressure", "neighbors" };
 
-const float viscosity = 0.01f;
+TripleBuffer<Snapshot> snapshots;
+std::atomic<bool> simulating(true);
+std::atomic<int> colorField(COLOR_PHASE);     // set by the render thread
 
-const float surfaceTension = 50.0f;
+// mouse push from the render thread, handed to the simulation before each step
+std::mutex interactionLock;
+bool pushing = false;
+ForceField push;
 
-struct Particle {
-    Vector3 position;
-    Vector3 velocity;
-    Vector3 acceleration;
-    float mass;
+void publishSnapshot(long long step) {
+    Snapshot& snapshot = snapshots.writeBuffer();
+    snapshot.positions.resize(particles.size());
+    for (size_t i = 0; i < particles.size(); i++) snapshot.positions[i] = particles[i].position;
+    snapshot.phaseStart.assign(1, 0);
+    for (size_t i = 0; i < particles.size(); i++) {
+        while ((int)snapshot.phaseStart.size() <= particles[i].phase) snapshot.phaseStart.push_back((int)i);
+    }
+    snapshot.phaseStart.push_back((int)particles.size());
+    snapshot.bodies.resize(rigidBodies.size());
+    for (size_t b = 0; b < rigidBodies.size(); b++) {
+        const RigidBody& body = rigidBodies[b];
+        snapshot.bodies[b] = {body.shape, body.halfExtents, body.position, body.orientation};
+    }
+    snapshot.secondaryPositions = secondaryParticles.positions;
+    snapshot.secondaryTypes = secondaryParticles.types;
+    snapshot.step = step;
+
+    const int field = colorField.load(std::memory_order_relaxed);
+    const int count = (int)particles.size();
+    const bool listed = (int)particleNeighbors.start.size() == count + 1;
+    snapshot.field = field;
+    snapshot.values.resize(field == COLOR_PHASE ? 0 : count);
+    for (int i = 0; i < (int)snapshot.values.size(); i++) {
+        const Particle& particle = particles[i];
+        float value = 0.0f;
+        if (field == COLOR_SPEED) value = Vector3Length(particle.velocity);
+        else if (field == COLOR_DENSITY) value = particle.density;
+        else if (field == COLOR_PRESSURE) value = particle.pressure;
+        else if (field == COLOR_NEIGHBORS && listed) value = (float)(particleNeighbors.start[i + 1] - particleNeighbors.start[i]);
+        snapshot.values[i] = value;
+    }
+    snapshot.valueMin = INFINITY;
+    snapshot.valueMax = -INFINITY;
+    for (float value : snapshot.values) {
+        snapshot.valueMin = fminf(snapshot.valueMin, value);
+        snapshot.valueMax = fmaxf(snapshot.valueMax, value);
+    }
+    snapshots.publish();
+}
 
-    float density;
-    float pressure;
-    Vector3 colorGradient;
-};
+CacheFrame frameView(const Snapshot& snapshot) {
+    CacheFrame frame;
+    frame.step = snapshot.step;
+    frame.particleCount = (int)snapshot.positions.size();
+    frame.positions = snapshot.positions.data();
+    frame.phaseCount = (int)snapshot.phaseStart.size() - 1;
+    frame.phaseStart = snapshot.phaseStart.data();
+    frame.bodyCount = (int)snapshot.bodies.size();
+    frame.bodies = snapshot.bodies.data();
+    frame.secondaryCount = (int)snapshot.secondaryPositions.size();
+    frame.secondaryPositions = snapshot.secondaryPositions.data();
+    frame.secondaryTypes = snapshot.secondaryTypes.data();
+    return frame;
+}
 
-Particle particles[numParticles];
+// runs the solver flat out on its own thread, independent of the frame rate
+void simulate() {
+    long long step = 0;
+    while (simulating.load(std::memory_order_relaxed)) {
+        {
+            std::lock_guard<std::mutex> lock(interactionLock);
+            forceFields.clear();
+            if (pushing) forceFields.push_back(push);
+        }
+        // the last finite state stays on screen; the solver already said why
+        if (!updateParticles(0.03f)) break;
+        publishSnapshot(++step);
+    }
+}
 
 cv::Mat textureToMat(Texture2D texture) {
     Image image = LoadImageFromTexture(texture);
@@ -63,144 +159,212 @@ cv::Mat textureToMat(Texture2D texture) {
     return mat_bgr;
 }
 
-float W_poly6(Vector3 r, float h) {
-    float magnitude = Vector3Length(r);
-    if (0 <= magnitude && magnitude <= h) {
-        return (315.f/(64.f*PI*powf(h, 9.f)))*powf(h*h - magnitude*magnitude, 3.f);
-    } else {
-        return 0.f;
+const Color phaseColors[maxFluidPhases] = { BLUE, GOLD, GREEN, MAROON };
+const Color secondaryColors[3] = { WHITE, LIGHTGRAY, SKYBLUE };    // spray, foam, bubble
+
+// The spheres are one instanced draw: DrawMeshInstanced uploads the transforms,
+// and one float per particle, its phase or the mapped field, goes to the shader's
+// instanceValue attribute from a buffer attached to the sphere's vertex array.
+std::vector<Matrix> transforms;
+std::vector<float> phaseValues;
+unsigned int valueBuffer = 0;
+int valueCapacity = 0;
+
+void uploadInstanceValues(const Mesh& mesh, int location, const float* values, int count) {
+    if (location < 0 || count == 0) return;
+    if (count > valueCapacity) {
+        if (valueBuffer) rlUnloadVertexBuffer(valueBuffer);
+        valueCapacity = std::max(count, 2*valueCapacity);
+        rlEnableVertexArray(mesh.vaoId);
+        valueBuffer = rlLoadVertexBuffer(nullptr, (int)(valueCapacity*sizeof(float)), true);
+        rlSetVertexAttribute(location, 1, RL_FLOAT, false, 0, 0);
+        rlEnableVertexAttribute(location);
+        rlSetVertexAttributeDivisor(location, 1);
+        rlDisableVertexBuffer();
+        rlDisableVertexArray();
     }
+    rlUpdateVertexBuffer(valueBuffer, values, (int)(count*sizeof(float)), 0);
 }
 
-float W_poly6_Gradient(Vector3 r, float h) {
-    float magnitude = Vector3Length(r);
-    if (0 <= magnitude && magnitude <= h) {
-        return (315.f/(64.f*PI*powf(h, 9.f)))*(-2.f*magnitude)*3.f*powf(h*h - magnitude*magnitude, 2.f);
-    } else {
-        return 0.f;
-    }
-}
-
-float W_poly6_Laplacian(Vector3 r, float h) {
-    float magnitude = Vector3Length(r);
-    if (0 <= magnitude && magnitude <= h) {
-        return (315.f/(64.f*PI*powf(h, 9.f)))*6.f*(h*h - magnitude*magnitude)*(5*magnitude*magnitude - h*h);
-    } else {
-        return 0.f;
-    }
-}
-
-
-float W_viscosity_Laplacian(Vector3 r, float h) {
-    float magnitude = Vector3Length(r);
-    if (0 <= magnitude && magnitude <= h) {
-        return (45.f/(PI*powf(h, 6.f)))*(h - magnitude);
-    } else {
-        return 0.f;
-    }
-}
-
-float W_spiky(Vector3 r, float h) {
-    float magnitude = Vector3Length(r);
-    if (0 <= magnitude && magnitude <= h) {
-        return (15.f/(PI*powf(h, 6.f)))*powf(h - magnitude, 3.f);
-    } else {
-        return 0.f;
+// values holds the mapped field per particle, nullptr to color by phase
+void drawFrame(const CacheFrame& frame, const float* values, raylib::Mesh& sphere, Material& material, int valueLocation) {
+    const int count = frame.particleCount;
+    transforms.resize(count);
+    for (int i = 0; i < count; i++) transforms[i] = MatrixTranslate(frame.positions[i].x, frame.positions[i].y, frame.positions[i].z);
+    if (!values) {
+        phaseValues.resize(count);
+        for (int phase = 0; phase < frame.phaseCount; phase++) {
+            std::fill(phaseValues.begin() + frame.phaseStart[phase], phaseValues.begin() + frame.phaseStart[phase + 1], (float)(phase % maxFluidPhases));
+        }
+        values = phaseValues.data();
     }
-}
-
-float W_spiky_Gradient(Vector3 r, float h) {
-    float magnitude = Vector3Length(r);
-    if (0 <= magnitude && magnitude <= h) {
-        return (15.f/(PI*powf(h, 6.f)))*(-1.f)*3.f*powf(h - magnitude, 2.f);
-    } else {
-        return 0.f;
+    uploadInstanceValues(sphere, valueLocation, values, count);
+    if (count > 0) DrawMeshInstanced(sphere, material, transforms.data(), count);
+    for (int s = 0; s < frame.secondaryCount; s++) DrawPoint3D(frame.secondaryPositions[s], secondaryColors[frame.secondaryTypes[s]]);
+    //for (int i = 0; i < numParticles; i++) DrawCylinderEx(particles[i].position, Vector3Add(particles[i].position, Vector3Scale(particles[i].acceleration, 0.03f)), 0.05f, 0.05f, 4, RED);
+    //DrawCubeWires(Vector3Zero(), 100.0f, 100.0f, 100.0f, RED);
+    DrawSphereWires(Vector3Zero(), sphereSize, 24, 48, GRAY);
+    for (int b = 0; b < frame.bodyCount; b++) {
+        const BodyPose& body = frame.bodies[b];
+        rlPushMatrix();
+        rlMultMatrixf(MatrixToFloat(MatrixMultiply(QuaternionToMatrix(body.orientation), MatrixTranslate(body.position.x, body.position.y, body.position.z))));
+        const Vector3 e = body.halfExtents;
+        if (body.shape == BODY_BOX) DrawCubeWires(Vector3Zero(), 2*e.x, 2*e.y, 2*e.z, ORANGE);
+        else DrawSphereWires(Vector3Zero(), e.x, 8, 16, ORANGE);
+        rlPopMatrix();
     }
 }
 
-float sampleDensity(Particle particle) {
-    float density = 0.0f;
-    for (int i = 0; i < numParticles; i++) {
-        density += particles[i].mass * W_poly6(Vector3Subtract(particle.position, particles[i].position), sampleRadius);
-    }
-    return density;
+// Motion blur: the particle positions sampled evenly over a frame's interval,
+// oldest first, and the positions of sub-frame k of K interpolated between them.
+// The sub-frames are summed in a float render texture and averaged back into the
+// canvas, so the frame is still read back once.
+std::vector<std::vector<Vector3> > shutterSamples;
+std::vector<const Vector3*> shutter;
+std::vector<Vector3> blurredPositions;
+
+void sampleShutter(int sample) {
+    shutterSamples[sample].resize(particles.size());
+    for (size_t i = 0; i < particles.size(); i++) shutterSamples[sample][i] = particles[i].position;
 }
 
-float samplePressure(Particle particle) {
-    float pressure = gasConstant*(particle.density - restDensity);
-    return pressure;
+void shutterPositions(int count, int k, int subFrames) {
+    const float t = (float)(k + 1)/subFrames*(shutter.size() - 1);
+    const int a = std::min((int)t, (int)shutter.size() - 2);
+    const float f = t - a;
+    blurredPositions.resize(count);
+    for (int i = 0; i < count; i++) blurredPositions[i] = Vector3Lerp(shutter[a][i], shutter[a + 1][i], f);
 }
 
-float sampleColor(Particle particle) {
-    float color = 0.0f;
-    for (int i = 0; i < numParticles; i++) {
-        color += particles[i].mass * (1.0f/particles[i].density) * W_poly6(Vector3Subtract(particle.position, particles[i].position), sampleRadius);
-    }
-    return color;
+// a render texture with a 32-bit float color buffer, so the sub-frames sum without rounding
+RenderTexture2D loadAccumulationTexture(int width, int height) {
+    RenderTexture2D target = LoadRenderTexture(width, height);
+    rlUnloadTexture(target.texture.id);
+    target.texture.id = rlLoadTexture(nullptr, width, height, PIXELFORMAT_UNCOMPRESSED_R32G32B32A32, 1);
+    target.texture.format = PIXELFORMAT_UNCOMPRESSED_R32G32B32A32;
+    rlFramebufferAttach(target.id, target.texture.id, RL_ATTACHMENT_COLOR_CHANNEL0, RL_ATTACHMENT_TEXTURE2D, 0);
+    return target;
 }
 
-Vector3 sampleColorGradient(Particle particle) {
-    Vector3 colorGradient = Vector3Zero();
-    for (int i = 0; i < numParticles; i++) {
-        Vector3 r = Vector3Subtract(particles[i].position, particle.position);
-        colorGradient = Vector3Add(colorGradient, Vector3Scale(Vector3Normalize(r), particles[i].mass * (1.0f/particles[i].density) * W_poly6_Gradient(r, sampleRadius)));
+// appends the segments' frames, in order, to one video through the same encoder as a render
+bool mergeSegments(const char* output, char** segments, int count) {
+    int codec = cv::VideoWriter::fourcc('a', 'v', 'c', '1');
+    cv::VideoWriter videoWriter;
+    cv::Mat image;
+    for (int s = 0; s < count; s++) {
+        cv::VideoCapture capture(segments[s]);
+        if (!capture.isOpened()) {
+            TraceLog(LOG_ERROR, "Can't open %s", segments[s]);
+            return false;
+        }
+        while (capture.read(image)) {
+            if (!videoWriter.isOpened()) {
+                videoWriter.open(output, codec, capture.get(cv::CAP_PROP_FPS), image.size(), true);
+                if (!videoWriter.isOpened()) {
+                    TraceLog(LOG_ERROR, "Can't write %s", output);
+                    return false;
+                }
+            }
+            videoWriter.write(image);
+        }
     }
-    return colorGradient;
+    videoWriter.release();
+    return true;
 }
 
-Vector3 sampleColorDivergence(Particle particle) {
-    Vector3 colorDivergence = Vector3Zero();
-    for (int i = 0; i < numParticles; i++) {
-        colorDivergence = Vector3Add(colorDivergence, Vector3Scale(particles[i].colorGradient, particles[i].mass * (1.0f/particles[i].density) * W_poly6_Laplacian(Vector3Subtract(particle.position, particles[i].position), sampleRadius)));
+// usage: Fluid65 [scene] [--camera path] [--color field] [--blur k] [--record cache] [--replay cache [--frames start:end]]
+//        Fluid65 --merge output segment...
+// With a camera path the shot is played back from the file: its scene and seed,
+// the camera on its keyframes, and the solver stepped deterministically in
+// lockstep with the frames instead of on its own thread, so every run gives the
+// same video. --record writes every rendered frame's particles to a cache;
+// --replay renders a cache instead of simulating, and with --frames only frames
+// [start, end) of it, into renders/frames_<start>.mp4, so separate processes can
+// render disjoint ranges that --merge then joins. --color (or C, live) colors
+// the particles by speed, density, pressure or neighbor count instead of phase.
+// --blur (or a camera path's blur) averages k sub-frames into every frame of an
+// offline render: the solver's steps within the frame, or a replay's previous
+// frame to this one.
+int main(int argc, char** argv) {
+    Scene scene = SCENE_DROP;
+    const char* cameraFile = nullptr;
+    const char* recordFile = nullptr;
+    const char* replayFile = nullptr;
+    int firstFrame = 0, lastFrame = INT_MAX;
+    int blur = 0;
+    bool ranged = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--merge") == 0 && i + 1 < argc) {
+            return mergeSegments(argv[i + 1], argv + i + 2, argc - i - 2) ? 0 : 1;
+        } else if (strcmp(argv[i], "--camera") == 0 && i + 1 < argc) {
+            cameraFile = argv[++i];
+        } else if (strcmp(argv[i], "--color") == 0 && i + 1 < argc) {
+            int field = 0;
+            while (field < COLOR_FIELDS && strcmp(argv[i + 1], colorFieldNames[field]) != 0) field++;
+            if (field == COLOR_FIELDS) {
+                TraceLog(LOG_ERROR, "Unknown color field %s", argv[i + 1]);
+                return 1;
+            }
+            colorField = field;
+            i++;
+        } else if (strcmp(argv[i], "--blur") == 0 && i + 1 < argc) {
+            blur = atoi(argv[++i]);
+            if (blur <= 0) {
+                TraceLog(LOG_ERROR, "Bad blur %s, expected a sub-frame count", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordFile = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayFile = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            ranged = true;
+            if (sscanf(argv[++i], "%d:%d", &firstFrame, &lastFrame) != 2 || firstFrame < 0 || lastFrame <= firstFrame) {
+                TraceLog(LOG_ERROR, "Bad frame range %s, expected start:end", argv[i]);
+                return 1;
+            }
+        } else if (!parseScene(argv[i], &scene)) {
+            TraceLog(LOG_ERROR, "Unknown scene %s", argv[i]);
+            return 1;
+        }
     }
-    return colorDivergence;
-}
-
-Vector3 samplePressureForce(Particle particle) {
-    Vector3 pressureForce = Vector3Zero();
-    for (int i = 0; i < numParticles; i++) {
-        Vector3 r = Vector3Subtract(particle.position, particles[i].position);
-        pressureForce = Vector3Subtract(pressureForce, Vector3Scale(Vector3Normalize(r), particles[i].mass * (particle.pressure + particles[i].pressure)/(2.0f * particles[i].density) * W_spiky_Gradient(r, sampleRadius)));
+    if (ranged && !replayFile) {
+        TraceLog(LOG_ERROR, "--frames needs --replay");
+        return 1;
     }
-    return pressureForce;
-}
 
-Vector3 sampleViscosityForce(Particle particle) {
-    Vector3 viscosityForce = Vector3Zero();
-    for (int i = 0; i < numParticles; i++) {
-        viscosityForce = Vector3Add(viscosityForce, Vector3Scale(Vector3Subtract(particles[i].velocity, particle.velocity), viscosity * particles[i].mass * (1.f/particles[i].density) * W_viscosity_Laplacian(Vector3Subtract(particle.position, particles[i].position), sampleRadius)));
+    CameraPath cameraPath;
+    const bool scripted = cameraFile != nullptr;
+    if (scripted) {
+        std::string error;
+        if (!loadCameraPath(cameraFile, cameraPath, error)) {
+            TraceLog(LOG_ERROR, "%s", error.c_str());
+            return 1;
+        }
+        if (!parseScene(cameraPath.scene.c_str(), &scene)) {
+            TraceLog(LOG_ERROR, "Unknown scene %s in %s", cameraPath.scene.c_str(), cameraFile);
+            return 1;
+        }
     }
-    return viscosityForce;
-}
-
-Vector3 sampleSurfaceTractionForce(Particle particle) {
-    Vector3 surfaceTractionForce = Vector3Scale(Vector3Normalize(particle.colorGradient), -surfaceTension*Vector3Length(sampleColorDivergence(particle)));
-    return surfaceTractionForce;
-}
-
-void updateParticles(float deltaTime) {
-    for (int i = 0; i < numParticles; i++) particles[i].density = sampleDensity(particles[i]);
-    for (int i = 0; i < numParticles; i++) particles[i].pressure = samplePressure(particles[i]);
-    for (int i = 0; i < numParticles; i++) particles[i].colorGradient = sampleColorGradient(particles[i]);
 
-    for (int i = 0; i < numParticles; i++) {
-        Vector3 netForce = Vector3Add(samplePressureForce(particles[i]), Vector3Scale({0.0f, 1.0f, 0.0f}, -0.1f*particles[i].mass));
-        netForce = Vector3Add(netForce, sampleViscosityForce(particles[i]));
-        netForce = Vector3Add(netForce, sampleSurfaceTractionForce(particles[i]));
-        particles[i].acceleration = Vector3Scale(netForce, 1.0f/particles[i].density);
-    }
-    for (int i = 0; i < numParticles; i++) {
-        particles[i].velocity = Vector3Add(particles[i].velocity, Vector3Scale(particles[i].acceleration, deltaTime));
-        if (Vector3Length(particles[i].position) >= sphereSize - 1.0f) {
-            //particles[i].position = Vector3Scale(Vector3Normalize(particles[i].position), sphereSize-1.0f);
-            //particles[i].velocity = Vector3Scale(Vector3Normalize(particles[i].position), sphereSize*-0.01f);
-            if (Vector3DotProduct(particles[i].position, particles[i].velocity) > 0.0f) particles[i].velocity = Vector3Scale(Vector3Reflect(particles[i].velocity, Vector3Negate(Vector3Normalize(particles[i].position))), 0.8f);
+    ParticleCache cache;
+    const bool replaying = replayFile != nullptr;
+    if (replaying) {
+        std::string error;
+        if (!openParticleCache(cache, replayFile, error)) {
+            TraceLog(LOG_ERROR, "%s", error.c_str());
+            return 1;
+        }
+        lastFrame = std::min(lastFrame, cacheFrameCount(cache));
+        if (firstFrame >= lastFrame) {
+            TraceLog(LOG_ERROR, "%s has %d frames, none in range", replayFile, cacheFrameCount(cache));
+            return 1;
         }
-        particles[i].position = Vector3Add(particles[i].position, Vector3Scale(particles[i].velocity, deltaTime));
     }
-}
-
-int main() {
+    // nothing live steers the camera or the solver
+    const bool offline = scripted || replaying;
+    if (blur == 0) blur = scripted ? cameraPath.motionBlur : 1;
+    if (!offline) blur = 1;
 
     int codec = cv::VideoWriter::fourcc('a', 'v', 'c', '1');
     cv::VideoWriter videoWriter;
@@ -212,18 +376,26 @@ int main() {
 
     raylib::Mesh sphere = GenMeshSphere(1.0f, 6, 12);    
     
-    std::default_random_engine generator(GetRandomValue(0, INT_MAX));
-    //std::uniform_real_distribution<float> distribution(-50.0, 50.0);
-    std::normal_distribution<float> distribution(0.0, 5.0);
-
-    for (int i = 0; i < numParticles; i++) {
-        particles[i].position = {distribution(generator), distribution(generator), distribution(generator)};
-        particles[i].velocity = Vector3Zero();
-        particles[i].mass = 1.0f;
-    }
+    deterministicMode = scripted && cameraPath.deterministic;
+    if (scripted && !replaying) setupScene(scene, cameraPath.particles, cameraPath.seed);
+    else if (!replaying) setupScene(scene, numParticles, GetRandomValue(0, INT_MAX));
+    secondarySettings.enabled = true;
 
     Shader shader = LoadShader("shaders/vert.glsl", "shaders/frag.glsl");
     shader.locs[SHADER_LOC_VECTOR_VIEW] = GetShaderLocation(shader, "viewPos");
+    shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(shader, "instanceTransform");
+    const int valueLoc = GetShaderLocationAttrib(shader, "instanceValue");
+    const int colorModeLoc = GetShaderLocation(shader, "colorMode");
+    const int valueRangeLoc = GetShaderLocation(shader, "valueRange");
+    float phaseColorValues[4*maxFluidPhases];
+    for (int phase = 0; phase < maxFluidPhases; phase++) {
+        const Vector4 color = ColorNormalize(phaseColors[phase]);
+        phaseColorValues[4*phase] = color.x;
+        phaseColorValues[4*phase + 1] = color.y;
+        phaseColorValues[4*phase + 2] = color.z;
+        phaseColorValues[4*phase + 3] = color.w;
+    }
+    SetShaderValueV(shader, GetShaderLocation(shader, "phaseColors"), phaseColorValues, SHADER_UNIFORM_VEC4, maxFluidPhases);
     
     // Ambient light level (some basic lighting)
     int ambientLoc = GetShaderLocation(shader, "ambient");
@@ -235,51 +407,185 @@ int main() {
 
     raylib::RenderTexture2D canvas(screenWidth, screenHeight);
 
-    SetTargetFPS(30);
+    RenderTexture2D accumulation = { 0 };
+    Shader resolve = { 0 };
+    int scaleLoc = -1;
+    if (blur > 1) {
+        accumulation = loadAccumulationTexture(screenWidth, screenHeight);
+        if (!rlFramebufferComplete(accumulation.id)) {
+            TraceLog(LOG_WARNING, "Float render textures are not supported, motion blur is off");
+            blur = 1;
+        }
+        resolve = LoadShader(0, "shaders/resolve.glsl");
+        scaleLoc = GetShaderLocation(resolve, "scale");
+    }
+
+    // an offline render goes as fast as it can; the video still plays at its frame rate
+    int frameRate = replaying ? cache.framesPerSecond : scripted ? cameraPath.framesPerSecond : GetMonitorRefreshRate(GetCurrentMonitor());
+    if (frameRate <= 0) frameRate = 30;
+    SetTargetFPS(offline ? 0 : frameRate);
 
+    ParticleCacheWriter recorder = {nullptr, 0};
+    if (recordFile && !createParticleCache(recorder, recordFile, frameRate)) {
+        TraceLog(LOG_ERROR, "Can't write %s", recordFile);
+        return 1;
+    }
+
+    std::thread simulation;
+    if (!replaying) {
+        publishSnapshot(0);
+        snapshots.update();
+        if (!scripted) simulation = std::thread(simulate);
+    }
+
+    long long frame = replaying ? firstFrame : 0;
     while (!window.ShouldClose())
     {
-        UpdateCamera(&camera, CAMERA_THIRD_PERSON);
-        SetMousePosition(0, 0);
+        if (replaying && frame >= lastFrame) break;
+        const float time = (float)frame/frameRate;
+        if (scripted) {
+            if (!replaying && time > cameraPathDuration(cameraPath)) break;
+            evaluateCameraPath(cameraPath, time, &camera.position, &camera.target, &camera.fovy);
+        } else if (!replaying) {
+            UpdateCamera(&camera, CAMERA_THIRD_PERSON);
+            SetMousePosition(0, 0);
+        }
+        shutter.clear();
+        if (scripted && !replaying) {
+            if (frame > 0) {
+                if (blur > 1) {
+                    shutterSamples.resize(cameraPath.stepsPerFrame + 1);
+                    sampleShutter(0);
+                }
+                bool stepped = true;
+                for (int s = 0; s < cameraPath.stepsPerFrame && stepped; s++) {
+                    stepped = updateParticles(cameraPath.deltaTime);
+                    if (stepped && blur > 1) sampleShutter(s + 1);
+                }
+                if (!stepped) {
+                    TraceLog(LOG_ERROR, "Simulation failed at frame %lld, stopping the render", frame);
+                    break;
+                }
+                // every sample needs the same particles; a frame where they differ is left sharp
+                if (blur > 1) {
+                    for (const std::vector<Vector3>& sample : shutterSamples) {
+                        if (sample.size() == particles.size()) shutter.push_back(sample.data());
+                    }
+                    if (shutter.size() != shutterSamples.size()) shutter.clear();
+                }
+            }
+            publishSnapshot(frame*cameraPath.stepsPerFrame);
+        }
 
-        SetShaderValue(shader, shader.locs[SHADER_LOC_VECTOR_VIEW], &camera.position.x, SHADER_UNIFORM_VEC3);
+        CacheFrame view;
+        const Snapshot* snapshot = nullptr;
+        if (replaying) {
+            view = cacheFrame(cache, (int)frame);
+        } else {
+            snapshots.update();
+            snapshot = &snapshots.readBuffer();
+            view = frameView(*snapshot);
+        }
+        // caches hold no fields, and a new field shows from the next snapshot on
+        const bool mapped = snapshot && snapshot->field != COLOR_PHASE;
+        const int colorMode = mapped;
+        SetShaderValue(shader, colorModeLoc, &colorMode, SHADER_UNIFORM_INT);
+        if (mapped) {
+            const float valueRange[2] = { snapshot->valueMin, snapshot->valueMax };
+            SetShaderValue(shader, valueRangeLoc, valueRange, SHADER_UNIFORM_VEC2);
+        }
+        if (replaying && blur > 1 && frame > 0) {
+            const CacheFrame previous = cacheFrame(cache, (int)frame - 1);
+            if (previous.particleCount == view.particleCount) {
+                shutter.push_back(previous.positions);
+                shutter.push_back(view.positions);
+            }
+        }
+        if (recorder.file && !appendCacheFrame(recorder, view)) TraceLog(LOG_WARNING, "Failed to record frame %lld", frame);
+        frame++;
+
+        // hold the left button to push the fluid along the view ray (the mouse itself steers the camera)
+        if (!offline) {
+            if (IsKeyPressed(KEY_C)) colorField = (colorField + 1) % COLOR_FIELDS;
+            std::lock_guard<std::mutex> lock(interactionLock);
+            pushing = IsMouseButtonDown(MOUSE_BUTTON_LEFT);
+            if (pushing) {
+                Ray ray = GetMouseRay({screenWidth/2.0f, screenHeight/2.0f}, camera);
+                push = rayField(ray.position, ray.direction, 1.0f, sampleRadius);
+            }
+        }
 
-        updateParticles(0.03f);
+        const int subFrames = shutter.empty() ? 1 : blur;
+        for (int k = 0; k < subFrames; k++) {
+            CacheFrame subFrame = view;
+            if (subFrames > 1) {
+                shutterPositions(view.particleCount, k, subFrames);
+                subFrame.positions = blurredPositions.data();
+                if (scripted) evaluateCameraPath(cameraPath, time - (1.0f - (k + 1.0f)/subFrames)/frameRate, &camera.position, &camera.target, &camera.fovy);
+            }
+            SetShaderValue(shader, shader.locs[SHADER_LOC_VECTOR_VIEW], &camera.position.x, SHADER_UNIFORM_VEC3);
 
-        canvas.BeginMode();
-        {
-            ClearBackground(BLACK);
-            camera.BeginMode();
+            canvas.BeginMode();
             {
-                for (int i = 0; i < numParticles; i++) sphere.Draw(material, MatrixTranslate(particles[i].position.x, particles[i].position.y, particles[i].position.z));
-                //for (int i = 0; i < numParticles; i++) DrawCylinderEx(particles[i].position, Vector3Add(particles[i].position, Vector3Scale(particles[i].acceleration, 0.03f)), 0.05f, 0.05f, 4, RED);
-                //DrawMeshInstanced(sphere, material, transforms.data(), numParticles);
-                //DrawCubeWires(Vector3Zero(), 100.0f, 100.0f, 100.0f, RED);
-                DrawSphereWires(Vector3Zero(), sphereSize, 24, 48, GRAY);
+                ClearBackground(BLACK);
+                camera.BeginMode();
+                drawFrame(subFrame, mapped ? snapshot->values.data() : nullptr, sphere, material, valueLoc);
+                camera.EndMode();
+                //raylib::DrawText(TextFormat("density = %.5f", particles[0].density), 10, 40, 20, WHITE);
             }
-            camera.EndMode();
-            //raylib::DrawText(TextFormat("density = %.5f", particles[0].density), 10, 40, 20, WHITE);
+            canvas.EndMode();
+
+            // render textures are stored upside down, so drawing one into another flips it;
+            // the flip into the sum and the flip back out of it cancel
+            if (subFrames > 1) {
+                BeginTextureMode(accumulation);
+                if (k == 0) ClearBackground(BLANK);
+                rlSetBlendFactors(RL_ONE, RL_ONE, RL_FUNC_ADD);
+                BeginBlendMode(BLEND_CUSTOM);
+                DrawTextureRec(canvas.texture, {0.0f, 0.0f, (float)screenWidth, -(float)screenHeight}, {0.0f, 0.0f}, WHITE);
+                EndBlendMode();
+                EndTextureMode();
+            }
+        }
+        if (subFrames > 1) {
+            const float scale = 1.0f/subFrames;
+            SetShaderValue(resolve, scaleLoc, &scale, SHADER_UNIFORM_FLOAT);
+            canvas.BeginMode();
+            BeginShaderMode(resolve);
+            DrawTextureRec(accumulation.texture, {0.0f, 0.0f, (float)screenWidth, -(float)screenHeight}, {0.0f, 0.0f}, WHITE);
+            EndShaderMode();
+            canvas.EndMode();
         }
-        canvas.EndMode();
 
         window.BeginDrawing();
         {
             canvas.GetTexture().Draw();
             window.DrawFPS();
+            DrawText(TextFormat("step %lld", view.step), 10, 40, 20, WHITE);
+            if (mapped) DrawText(TextFormat("%s %g to %g", colorFieldNames[snapshot->field], snapshot->valueMin, snapshot->valueMax), 10, 70, 20, WHITE);
         }
         window.EndDrawing();
 
-        cv::Mat frame = textureToMat(canvas.texture);
+        cv::Mat image = textureToMat(canvas.texture);
         if (!videoWriter.isOpened()) {
-            cv::Size frameSize = frame.size();
-            videoWriter.open("renders/render.mp4", codec, 30, frameSize, true);
+            cv::Size frameSize = image.size();
+            const char* videoFile = ranged ? TextFormat("renders/frames_%06d.mp4", firstFrame) : "renders/render.mp4";
+            videoWriter.open(videoFile, codec, frameRate, frameSize, true);
             if (!videoWriter.isOpened()) TraceLog(LOG_WARNING, "Failed to open videoWriter");
         }
 
-        videoWriter.write(frame);
+        videoWriter.write(image);
     }
 
+    simulating = false;
+    if (simulation.joinable()) simulation.join();
+
+    if (recorder.file && !finishParticleCache(recorder)) TraceLog(LOG_WARNING, "Failed to write %s", recordFile);
+    if (replaying) closeParticleCache(cache);
+
     videoWriter.release();
+    if (accumulation.id) UnloadRenderTexture(accumulation);
+    if (resolve.id) UnloadShader(resolve);
     UnloadShader(shader);
     //UnloadMaterial(material);
 }
@@ -0,0 +1,184 @@
+#include "particlecache.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const uint32_t cacheVersion = 1;
+static const size_t cacheHeaderSize = 12;
+static const size_t frameHeaderSize = 28;
+
+// bodies are read in place as BodyPose
+static_assert(sizeof(BodyPose) == sizeof(int32_t) + 10*sizeof(float), "BodyPose must match the cache layout");
+
+static inline size_t padded(size_t bytes) {
+    return (bytes + 3) & ~(size_t)3;
+}
+
+static size_t frameSize(size_t particles, size_t phases, size_t bodies, size_t secondary) {
+    return frameHeaderSize + sizeof(int32_t)*(phases + 1) + 3*sizeof(float)*particles +
+           (sizeof(int32_t) + 10*sizeof(float))*bodies + 3*sizeof(float)*secondary + padded(secondary);
+}
+
+bool createParticleCache(ParticleCacheWriter& writer, const char* path, int framesPerSecond) {
+    writer.frames = 0;
+    writer.file = fopen(path, "wb");
+    if (!writer.file) return false;
+    const uint32_t fps = (uint32_t)framesPerSecond;
+    fwrite("F65C", 1, 4, writer.file);
+    fwrite(&cacheVersion, sizeof(cacheVersion), 1, writer.file);
+    fwrite(&fps, sizeof(fps), 1, writer.file);
+    return !ferror(writer.file);
+}
+
+bool appendCacheFrame(ParticleCacheWriter& writer, const CacheFrame& frame) {
+    if (!writer.file) return false;
+    const uint32_t header[5] = {
+        (uint32_t)frameSize(frame.particleCount, frame.phaseCount, frame.bodyCount, frame.secondaryCount),
+        (uint32_t)frame.particleCount, (uint32_t)frame.phaseCount, (uint32_t)frame.bodyCount, (uint32_t)frame.secondaryCount
+    };
+    const int64_t step = frame.step;
+    fwrite(header, sizeof(uint32_t), 5, writer.file);
+    fwrite(&step, sizeof(step), 1, writer.file);
+    for (int p = 0; p <= frame.phaseCount; p++) {
+        const int32_t start = frame.phaseStart[p];
+        fwrite(&start, sizeof(start), 1, writer.file);
+    }
+    if (frame.particleCount > 0) fwrite(frame.positions, sizeof(Vector3), frame.particleCount, writer.file);
+    for (int b = 0; b < frame.bodyCount; b++) {
+        const BodyPose& body = frame.bodies[b];
+        const int32_t shape = body.shape;
+        fwrite(&shape, sizeof(shape), 1, writer.file);
+        fwrite(&body.halfExtents, sizeof(Vector3), 1, writer.file);
+        fwrite(&body.position, sizeof(Vector3), 1, writer.file);
+        fwrite(&body.orientation, sizeof(Quaternion), 1, writer.file);
+    }
+    if (frame.secondaryCount > 0) {
+        fwrite(frame.secondaryPositions, sizeof(Vector3), frame.secondaryCount, writer.file);
+        fwrite(frame.secondaryTypes, 1, frame.secondaryCount, writer.file);
+    }
+    const unsigned char zeros[3] = {0, 0, 0};
+    fwrite(zeros, 1, padded(frame.secondaryCount) - frame.secondaryCount, writer.file);
+    writer.frames++;
+    return !ferror(writer.file);
+}
+
+bool finishParticleCache(ParticleCacheWriter& writer) {
+    if (!writer.file) return false;
+    const bool written = fclose(writer.file) == 0;
+    writer.file = nullptr;
+    return written;
+}
+
+static void unmap(ParticleCache& cache) {
+#if defined(_WIN32)
+    if (cache.data) UnmapViewOfFile(cache.data);
+    if (cache.mapping) CloseHandle((HANDLE)cache.mapping);
+#else
+    if (cache.data) munmap((void*)cache.data, cache.size);
+#endif
+    cache.data = nullptr;
+    cache.mapping = nullptr;
+    cache.size = 0;
+}
+
+bool openParticleCache(ParticleCache& cache, const char* path, std::string& error) {
+    cache.data = nullptr;
+    cache.size = 0;
+    cache.mapping = nullptr;
+    cache.framesPerSecond = 0;
+    cache.frameOffsets.clear();
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error = std::string("can't open ") + path;
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size)) cache.size = (size_t)size.QuadPart;
+    if (cache.size > 0) {
+        cache.mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (cache.mapping) cache.data = (const unsigned char*)MapViewOfFile((HANDLE)cache.mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    CloseHandle(file);
+#else
+    const int file = open(path, O_RDONLY);
+    if (file < 0) {
+        error = std::string("can't open ") + path;
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) == 0) cache.size = (size_t)status.st_size;
+    if (cache.size > 0) {
+        void* data = mmap(nullptr, cache.size, PROT_READ, MAP_SHARED, file, 0);
+        if (data != MAP_FAILED) cache.data = (const unsigned char*)data;
+    }
+    close(file);
+#endif
+
+    uint32_t version = 0, fps = 0;
+    if (cache.data && cache.size >= cacheHeaderSize) {
+        memcpy(&version, cache.data + 4, sizeof(version));
+        memcpy(&fps, cache.data + 8, sizeof(fps));
+    }
+    if (!cache.data || cache.size < cacheHeaderSize || memcmp(cache.data, "F65C", 4) != 0 || version != cacheVersion) {
+        error = std::string(path) + ": not a particle cache";
+        unmap(cache);
+        return false;
+    }
+    cache.framesPerSecond = (int)fps;
+
+    // walk the frame sizes once; only the frame headers are paged in
+    size_t offset = cacheHeaderSize;
+    while (offset + frameHeaderSize <= cache.size) {
+        uint32_t header[5];
+        memcpy(header, cache.data + offset, sizeof(header));
+        if (header[0] != frameSize(header[1], header[2], header[3], header[4]) ||
+            header[0] > cache.size - offset) break;
+        cache.frameOffsets.push_back(offset);
+        offset += header[0];
+    }
+    return true;
+}
+
+void closeParticleCache(ParticleCache& cache) {
+    unmap(cache);
+    cache.frameOffsets.clear();
+}
+
+CacheFrame cacheFrame(const ParticleCache& cache, int frame) {
+    const unsigned char* data = cache.data + cache.frameOffsets[frame];
+    uint32_t header[5];
+    int64_t step;
+    memcpy(header, data, sizeof(header));
+    memcpy(&step, data + 20, sizeof(step));
+
+    CacheFrame view;
+    view.step = step;
+    view.particleCount = (int)header[1];
+    view.phaseCount = (int)header[2];
+    view.bodyCount = (int)header[3];
+    view.secondaryCount = (int)header[4];
+    data += frameHeaderSize;
+    view.phaseStart = (const int*)data;
+    data += sizeof(int32_t)*(view.phaseCount + 1);
+    view.positions = (const Vector3*)data;
+    data += sizeof(Vector3)*view.particleCount;
+    view.bodies = (const BodyPose*)data;
+    data += sizeof(BodyPose)*view.bodyCount;
+    view.secondaryPositions = (const Vector3*)data;
+    data += sizeof(Vector3)*view.secondaryCount;
+    view.secondaryTypes = data;
+    return view;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <raymath.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// a rigid body as far as drawing it goes
+struct BodyPose {
+    int shape;                  // RigidBodyShape
+    Vector3 halfExtents;
+    Vector3 position;
+    Quaternion orientation;
+};
+
+// one recorded frame, pointing into whoever holds it: a snapshot's vectors or
+// the mapped cache file
+struct CacheFrame {
+    long long step;
+    int particleCount;
+    const Vector3* positions;
+    int phaseCount;
+    const int* phaseStart;          // phaseCount + 1 entries, particles are grouped by phase
+    int bodyCount;
+    const BodyPose* bodies;
+    int secondaryCount;
+    const Vector3* secondaryPositions;
+    const unsigned char* secondaryTypes;
+};
+
+// little-endian binary: "F65C", uint32 version (1), uint32 frames per second,
+// then frames back to back. Each frame is uint32 byte size (of the whole frame),
+// uint32 particle, phase, body and secondary counts, int64 step, int32
+// phaseStart[phases + 1], float positions[3*particles], the bodies as int32
+// shape and 10 floats, float secondary positions[3*secondary] and uint8
+// types[secondary], padded to 4 bytes. Every array starts 4-byte aligned, so a
+// mapped frame is read in place.
+struct ParticleCacheWriter {
+    FILE* file;
+    long long frames;
+};
+
+bool createParticleCache(ParticleCacheWriter& writer, const char* path, int framesPerSecond);
+bool appendCacheFrame(ParticleCacheWriter& writer, const CacheFrame& frame);
+bool finishParticleCache(ParticleCacheWriter& writer);
+
+// a cache file mapped into memory; frames are views into the mapping, so a
+// render node touches only the pages of the frames it renders
+struct ParticleCache {
+    const unsigned char* data;
+    size_t size;
+    int framesPerSecond;
+    std::vector<size_t> frameOffsets;
+    void* mapping;              // platform handle, for closeParticleCache
+};
+
+// Returns false, with a message in error, if the file can't be mapped or isn't a
+// cache. A frame cut short by a recorder that didn't finish is dropped.
+bool openParticleCache(ParticleCache& cache, const char* path, std::string& error);
+void closeParticleCache(ParticleCache& cache);
+
+inline int cacheFrameCount(const ParticleCache& cache) { return (int)cache.frameOffsets.size(); }
+CacheFrame cacheFrame(const ParticleCache& cache, int frame);
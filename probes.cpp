@@ -0,0 +1,194 @@
+#include "probes.h"
+
+#include "fluid.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+std::vector<Probe> probes;
+std::string probeDirectory = ".";
+
+static long long probeStep = 0;
+static NeighborList probeNeighbors;
+
+Probe planeProbe(const char* name, Vector3 origin, Vector3 u, Vector3 v, int width, int height, int interval, ProbeFormat format) {
+    Probe probe;
+    probe.name = name;
+    probe.width = width > 0 ? width : 1;
+    probe.height = height > 0 ? height : 1;
+    probe.interval = interval > 0 ? interval : 1;
+    probe.format = format;
+    probe.points.resize((size_t)probe.width*probe.height);
+    for (int y = 0; y < probe.height; y++) {
+        for (int x = 0; x < probe.width; x++) {
+            const float s = probe.width > 1 ? (float)x/(probe.width - 1) : 0.5f;
+            const float t = probe.height > 1 ? (float)y/(probe.height - 1) : 0.5f;
+            probe.points[(size_t)y*probe.width + x] = Vector3Add(origin, Vector3Add(Vector3Scale(u, s), Vector3Scale(v, t)));
+        }
+    }
+    return probe;
+}
+
+Probe pointProbe(const char* name, const std::vector<Vector3>& points, int interval, ProbeFormat format) {
+    Probe probe;
+    probe.name = name;
+    probe.points = points;
+    probe.width = (int)points.size();
+    probe.height = 1;
+    probe.interval = interval > 0 ? interval : 1;
+    probe.format = format;
+    return probe;
+}
+
+Probe sliceProbe(const char* name, int axis, float offset, int resolution, int interval, ProbeFormat format) {
+    const float R = sphereSize;
+    Vector3 origin, u, v;
+    if (axis == 0) {
+        origin = {offset, -R, -R}; u = {0.0f, 0.0f, 2*R}; v = {0.0f, 2*R, 0.0f};
+    } else if (axis == 1) {
+        origin = {-R, offset, -R}; u = {2*R, 0.0f, 0.0f}; v = {0.0f, 0.0f, 2*R};
+    } else {
+        origin = {-R, -R, offset}; u = {2*R, 0.0f, 0.0f}; v = {0.0f, 2*R, 0.0f};
+    }
+    return planeProbe(name, origin, u, v, resolution, resolution, interval, format);
+}
+
+void sampleProbe(const Probe& probe, ProbeSamples& samples) {
+    const int count = (int)probe.points.size();
+    samples.density.assign(count, 0.0f);
+    samples.pressure.assign(count, 0.0f);
+    samples.velocity.assign(count, Vector3Zero());
+    if (count == 0 || particles.empty()) return;
+
+    queryParticles(probeNeighbors, probe.points.data(), count, sizeof(Vector3), sampleRadius);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int s = 0; s < count; s++) {
+        const Vector3 p = probe.points[s];
+        float density = 0.0f, pressure = 0.0f;
+        Vector3 velocity = Vector3Zero();
+        for (int k = probeNeighbors.start[s]; k < probeNeighbors.start[s + 1]; k++) {
+            const Particle& other = particles[probeNeighbors.index[k]];
+            const float w = W_poly6(Vector3Subtract(p, other.position), sampleRadius);
+            const float volume = other.mass/other.density;
+            density += other.mass*w;
+            pressure += volume*other.pressure*w;
+            velocity = Vector3Add(velocity, Vector3Scale(other.velocity, volume*w));
+        }
+        samples.density[s] = density;
+        samples.pressure[s] = pressure;
+        samples.velocity[s] = velocity;
+    }
+}
+
+// a probe's samples from one step, waiting for the writer thread
+struct ProbeFile {
+    Probe probe;
+    long long step;
+    ProbeSamples samples;
+};
+
+// portable float map, little-endian (negative scale), rows from the bottom up
+static bool writePfm(const std::string& path, const float* data, int width, int height, int channels) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    fprintf(file, "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height);
+    for (int y = 0; y < height; y++) fwrite(data + (size_t)y*width*channels, sizeof(float), (size_t)width*channels, file);
+    return fclose(file) == 0;
+}
+
+static bool writeProbeFile(const ProbeFile& job) {
+    const Probe& probe = job.probe;
+    const ProbeSamples& samples = job.samples;
+    const std::string stem = probeDirectory + "/" + probe.name;
+    char step[32];
+    snprintf(step, sizeof(step), "%06lld", job.step);
+
+    if (probe.format == PROBE_IMAGE) {
+        return writePfm(stem + "_density_" + step + ".pfm", samples.density.data(), probe.width, probe.height, 1) &&
+               writePfm(stem + "_pressure_" + step + ".pfm", samples.pressure.data(), probe.width, probe.height, 1) &&
+               writePfm(stem + "_velocity_" + step + ".pfm", &samples.velocity[0].x, probe.width, probe.height, 3);
+    }
+
+    FILE* file = fopen((stem + "_" + step + ".csv").c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "x,y,z,density,pressure,vx,vy,vz\n");
+    for (size_t s = 0; s < probe.points.size(); s++) {
+        const Vector3 p = probe.points[s], v = samples.velocity[s];
+        fprintf(file, "%g,%g,%g,%g,%g,%g,%g,%g\n", p.x, p.y, p.z, samples.density[s], samples.pressure[s], v.x, v.y, v.z);
+    }
+    return fclose(file) == 0;
+}
+
+// one thread draining a queue of files, started with the first one
+static struct ProbeWriter {
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<ProbeFile> queue;
+    std::thread thread;
+    bool busy = false;
+    bool stopping = false;
+
+    void push(ProbeFile& job) {
+        std::unique_lock<std::mutex> guard(lock);
+        queue.push_back(ProbeFile());
+        std::swap(queue.back(), job);
+        if (!thread.joinable()) thread = std::thread(&ProbeWriter::run, this);
+        wake.notify_one();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            ProbeFile job;
+            std::swap(job, queue.front());
+            queue.pop_front();
+            busy = true;
+            guard.unlock();
+            if (!writeProbeFile(job)) fprintf(stderr, "fluid65: failed to write probe %s in %s\n", job.probe.name.c_str(), probeDirectory.c_str());
+            guard.lock();
+            busy = false;
+            if (queue.empty()) idle.notify_all();
+        }
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> guard(lock);
+        idle.wait(guard, [this]() { return queue.empty() && !busy; });
+    }
+
+    ~ProbeWriter() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (thread.joinable()) thread.join();
+    }
+} probeWriter;
+
+void updateProbes() {
+    probeStep++;
+    for (const Probe& probe : probes) {
+        if (probeStep % probe.interval != 0) continue;
+        ProbeFile job;
+        job.probe = probe;
+        job.step = probeStep;
+        sampleProbe(probe, job.samples);
+        probeWriter.push(job);
+    }
+}
+
+void flushProbes() {
+    probeWriter.flush();
+}
+
+void restartProbes() {
+    probeStep = 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <raymath.h>
+#include <string>
+#include <vector>
+
+enum ProbeFormat {
+    PROBE_IMAGE,    // one float image per field: <name>_density_<step>.pfm, _pressure_, _velocity_ (3 channels)
+    PROBE_CSV       // <name>_<step>.csv, one row per sample point
+};
+
+// a set of points the fluid fields are sampled at every interval steps. For a
+// plane the points are row-major, width x height; a point set is width x 1.
+struct Probe {
+    std::string name;
+    std::vector<Vector3> points;
+    int width, height;
+    int interval;
+    ProbeFormat format;
+};
+
+// width x height samples over origin + [0, 1]*u + [0, 1]*v
+Probe planeProbe(const char* name, Vector3 origin, Vector3 u, Vector3 v, int width, int height, int interval, ProbeFormat format);
+Probe pointProbe(const char* name, const std::vector<Vector3>& points, int interval, ProbeFormat format);
+
+// the plane through the sphere at offset along axis (0 x, 1 y, 2 z), resolution^2 samples
+Probe sliceProbe(const char* name, int axis, float offset, int resolution, int interval, ProbeFormat format);
+
+// SPH interpolation at each point, from the particles within sampleRadius:
+// density sum m W, pressure and velocity sum m/rho A W
+struct ProbeSamples {
+    std::vector<float> density;
+    std::vector<float> pressure;
+    std::vector<Vector3> velocity;
+};
+
+void sampleProbe(const Probe& probe, ProbeSamples& samples);
+
+extern std::vector<Probe> probes;
+extern std::string probeDirectory;
+
+// run by updateParticles after every step: samples the probes that are due and
+// hands their files to a writer thread, so the step never waits on the disk
+void updateProbes();
+
+// blocks until every queued file is written
+void flushProbes();
+
+// numbers the steps from 0 again, called by setupScene
+void restartProbes();
@@ -0,0 +1,142 @@
+// Python bindings for the solver core. Particle arrays are exposed as NumPy
+// views straight onto the particles vector, so nothing is copied per frame.
+
+#include "fluid.h"
+#include "scenes.h"
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+namespace py = pybind11;
+
+// the solver state is global, so only one Simulation may be alive at a time
+class Simulation {
+public:
+    Simulation(const std::string& scene, int count, unsigned int seed) {
+        if (live) throw std::runtime_error("fluid65: only one Simulation can exist at a time");
+        reset(scene, count, seed);
+        live = true;
+    }
+
+    ~Simulation() {
+        live = false;
+    }
+
+    void reset(const std::string& scene, int count, unsigned int seed) {
+        Scene parsed;
+        if (!parseScene(scene.c_str(), &parsed)) throw std::invalid_argument("fluid65: unknown scene '" + scene + "'");
+        if (count < 0) throw std::invalid_argument("fluid65: particle count must not be negative");
+        setupScene(parsed, count, seed);
+    }
+
+    void step(int steps, float deltaTime) {
+        bool stepped = true;
+        {
+            py::gil_scoped_release release;
+            // the views are writable, so the particles may have been moved since the last call
+            invalidateParticleGrid();
+            for (int s = 0; s < steps && stepped; s++) stepped = updateParticles(deltaTime);
+        }
+        if (!stepped) throw std::runtime_error("fluid65: the step went non-finite and could not be recovered; the particles keep the last finite state");
+    }
+
+    // (start, index) arrays, the neighbors of points[q] being index[start[q]:start[q+1]]
+    py::tuple query(py::array_t<float, py::array::c_style | py::array::forcecast> points, float radius) {
+        if (points.ndim() != 2 || points.shape(1) != 3) throw std::invalid_argument("fluid65: points must be an (M, 3) array");
+        if (!(radius >= 0.0f)) throw std::invalid_argument("fluid65: radius must not be negative");
+        const int count = (int)points.shape(0);
+        NeighborList results;
+        {
+            py::gil_scoped_release release;
+            // positions written through the views are not in the grid
+            invalidateParticleGrid();
+            queryParticles(results, (const Vector3*)points.data(), count, 3*sizeof(float), radius);
+        }
+        py::array_t<int> start(results.start.size(), results.start.data());
+        py::array_t<int> index(results.index.size(), results.index.data());
+        return py::make_tuple(start, index);
+    }
+
+    int size() const {
+        return (int)particles.size();
+    }
+
+private:
+    static bool live;
+};
+
+bool Simulation::live = false;
+
+// (N, 3) float32 view of a Vector3 member of every particle
+static py::array_t<float> vectorView(py::object owner, size_t offset) {
+    float* data = particles.empty() ? nullptr : (float*)((char*)particles.data() + offset);
+    return py::array_t<float>({(py::ssize_t)particles.size(), (py::ssize_t)3},
+                              {(py::ssize_t)sizeof(Particle), (py::ssize_t)sizeof(float)},
+                              data, owner);
+}
+
+// (N,) float32 view of a float member of every particle
+static py::array_t<float> scalarView(py::object owner, size_t offset) {
+    float* data = particles.empty() ? nullptr : (float*)((char*)particles.data() + offset);
+    return py::array_t<float>({(py::ssize_t)particles.size()}, {(py::ssize_t)sizeof(Particle)}, data, owner);
+}
+
+// (N,) int32 view of the particle phases
+static py::array_t<int> phaseView(py::object owner) {
+    int* data = particles.empty() ? nullptr : (int*)((char*)particles.data() + offsetof(Particle, phase));
+    return py::array_t<int>({(py::ssize_t)particles.size()}, {(py::ssize_t)sizeof(Particle)}, data, owner);
+}
+
+#define FLUID65_PARAMETER(name, variable) \
+    def_property(name, [](const Simulation&) { return variable; }, [](Simulation&, float value) { variable = value; })
+
+PYBIND11_MODULE(fluid65, m) {
+    m.doc() = "Fluid65 SPH solver";
+
+    py::class_<Simulation>(m, "Simulation")
+        .def(py::init<const std::string&, int, unsigned int>(),
+             py::arg("scene") = "drop", py::arg("particles") = 1000, py::arg("seed") = 65)
+        .def("reset", &Simulation::reset,
+             py::arg("scene") = "drop", py::arg("particles") = 1000, py::arg("seed") = 65,
+             "Lay out a new scene. Arrays taken before the reset must not be used afterwards.")
+        .def("step", &Simulation::step, py::arg("n") = 1, py::arg("dt") = 0.03f,
+             "Advance n steps of dt with the GIL released. Raises RuntimeError if a step "
+             "goes non-finite and the blowup guard can't recover it, and on every later call "
+             "until reset.")
+        .def("query", &Simulation::query, py::arg("points"), py::arg("radius"),
+             "Particles within radius of each of the (M, 3) points, as (start, index) int32 arrays.")
+        .def("__len__", &Simulation::size)
+        .def_property_readonly("positions", [](py::object self) { return vectorView(self, offsetof(Particle, position)); },
+                               "(N, 3) view of the particle positions, valid until reset")
+        .def_property_readonly("velocities", [](py::object self) { return vectorView(self, offsetof(Particle, velocity)); },
+                               "(N, 3) view of the particle velocities, valid until reset")
+        .def_property_readonly("densities", [](py::object self) { return scalarView(self, offsetof(Particle, density)); },
+                               "(N,) view of the particle densities, valid until reset")
+        .def_property_readonly("pressures", [](py::object self) { return scalarView(self, offsetof(Particle, pressure)); },
+                               "(N,) view of the particle pressures, valid until reset")
+        .def_property_readonly("phases", [](py::object self) { return phaseView(self); },
+                               "(N,) view of the particle phase indices, valid until reset")
+        .FLUID65_PARAMETER("sphere_size", sphereSize)
+        .FLUID65_PARAMETER("sample_radius", sampleRadius)
+        .FLUID65_PARAMETER("rest_density", restDensity)
+        .FLUID65_PARAMETER("gas_constant", gasConstant)
+        .FLUID65_PARAMETER("viscosity", viscosity)
+        .FLUID65_PARAMETER("surface_tension", surfaceTension)
+        .FLUID65_PARAMETER("gravity", gravity)
+        .def_property("threads", [](const Simulation&) { return getThreadCount(); },
+                      [](Simulation&, int threads) { setThreadCount(threads); })
+        .def_property_readonly("diagnostics", [](const Simulation&) {
+            py::dict d;
+            d["kinetic_energy"] = diagnostics.kineticEnergy;
+            d["potential_energy"] = diagnostics.potentialEnergy;
+            d["linear_momentum"] = py::make_tuple(diagnostics.linearMomentum.x, diagnostics.linearMomentum.y, diagnostics.linearMomentum.z);
+            d["angular_momentum"] = py::make_tuple(diagnostics.angularMomentum.x, diagnostics.angularMomentum.y, diagnostics.angularMomentum.z);
+            d["failed_steps"] = diagnostics.failedSteps;
+            d["stalled"] = diagnostics.stalled;
+            return d;
+        });
+}
@@ -0,0 +1,124 @@
+#include "rigidbody.h"
+
+#include "fluid.h"
+#include "forcefields.h"
+
+#include <cmath>
+
+std::vector<RigidBody> rigidBodies;
+
+static RigidBody makeBody(RigidBodyShape shape, Vector3 halfExtents, Vector3 center, float relativeDensity) {
+    RigidBody body;
+    body.shape = shape;
+    body.halfExtents = halfExtents;
+    body.position = center;
+    body.orientation = QuaternionIdentity();
+    body.velocity = Vector3Zero();
+    body.angularVelocity = Vector3Zero();
+    body.relativeDensity = relativeDensity;
+    body.volume = 0.0f;
+    body.inertia = Vector3Zero();
+    body.radius = 0.0f;
+    body.volumeRadius = 0.0f;
+    body.force = Vector3Zero();
+    body.torque = Vector3Zero();
+    body.dynamic = true;
+    return body;
+}
+
+// Fibonacci lattice, roughly spacing apart
+RigidBody sphereBody(Vector3 center, float radius, float relativeDensity, float spacing) {
+    RigidBody body = makeBody(BODY_SPHERE, {radius, radius, radius}, center, relativeDensity);
+    body.volume = 4.0f/3.0f*PI*radius*radius*radius;
+    float moment = 0.4f*radius*radius;
+    body.inertia = {moment, moment, moment};
+    body.radius = radius;
+
+    const int count = (int)ceilf(4.0f*PI*radius*radius/(spacing*spacing));
+    const float golden = PI*(3.0f - sqrtf(5.0f));
+    for (int k = 0; k < count; k++) {
+        float y = 1.0f - 2.0f*(k + 0.5f)/count;
+        float ring = sqrtf(1.0f - y*y);
+        float angle = golden*k;
+        body.samples.push_back({radius*ring*cosf(angle), radius*y, radius*ring*sinf(angle)});
+    }
+    return body;
+}
+
+// a lattice over the box, keeping the points on its faces
+RigidBody boxBody(Vector3 center, Vector3 halfExtents, float relativeDensity, float spacing) {
+    RigidBody body = makeBody(BODY_BOX, halfExtents, center, relativeDensity);
+    const Vector3 e = halfExtents;
+    body.volume = 8.0f*e.x*e.y*e.z;
+    body.inertia = {(e.y*e.y + e.z*e.z)/3.0f, (e.x*e.x + e.z*e.z)/3.0f, (e.x*e.x + e.y*e.y)/3.0f};
+    body.radius = Vector3Length(e);
+
+    const int nx = (int)ceilf(2.0f*e.x/spacing), ny = (int)ceilf(2.0f*e.y/spacing), nz = (int)ceilf(2.0f*e.z/spacing);
+    for (int x = 0; x <= nx; x++) {
+        for (int y = 0; y <= ny; y++) {
+            for (int z = 0; z <= nz; z++) {
+                bool face = x == 0 || x == nx || y == 0 || y == ny || z == 0 || z == nz;
+                if (!face) continue;
+                body.samples.push_back({-e.x + 2.0f*e.x*x/nx, -e.y + 2.0f*e.y*y/ny, -e.z + 2.0f*e.z*z/nz});
+            }
+        }
+    }
+    return body;
+}
+
+// Akinci et al. 2012: a sample stands for the volume 1/sum_k W(x_b - x_k) of its own body
+void updateSampleVolumes(RigidBody& body, float h) {
+    if (body.volumeRadius == h && body.sampleVolumes.size() == body.samples.size()) return;
+    const int count = (int)body.samples.size();
+    body.sampleVolumes.resize(count);
+    for (int b = 0; b < count; b++) {
+        float sum = 0.0f;
+        for (int k = 0; k < count; k++) sum += W_poly6(Vector3Subtract(body.samples[b], body.samples[k]), h);
+        body.sampleVolumes[b] = sum > 0.0f ? 1.0f/sum : 0.0f;
+    }
+    body.volumeRadius = h;
+}
+
+Vector3 sampleWorldPosition(const RigidBody& body, int k) {
+    return Vector3Add(body.position, Vector3RotateByQuaternion(body.samples[k], body.orientation));
+}
+
+Vector3 sampleWorldVelocity(const RigidBody& body, Vector3 worldPosition) {
+    return Vector3Add(body.velocity, Vector3CrossProduct(body.angularVelocity, Vector3Subtract(worldPosition, body.position)));
+}
+
+void integrateRigidBodies(float deltaTime, float fluidDensity, float externalScale) {
+    for (RigidBody& body : rigidBodies) {
+        if (!body.dynamic) {
+            body.velocity = Vector3Zero();
+            body.angularVelocity = Vector3Zero();
+            continue;
+        }
+
+        Vector3 external = {0.0f, -gravity, 0.0f};
+        applyForceFields(forceFields, &body.position, 1, sizeof(RigidBody), &external);
+
+        const float mass = body.relativeDensity*fluidDensity*body.volume;
+        Vector3 acceleration = Vector3Scale(external, externalScale);
+        if (mass > 0.0f) acceleration = Vector3Add(acceleration, Vector3Scale(body.force, 1.0f/mass));
+        body.velocity = Vector3Add(body.velocity, Vector3Scale(acceleration, deltaTime));
+
+        // the principal axes turn with the body, so the torque is applied in the body frame
+        if (mass > 0.0f) {
+            const Quaternion inverse = {-body.orientation.x, -body.orientation.y, -body.orientation.z, body.orientation.w};
+            Vector3 torque = Vector3RotateByQuaternion(body.torque, inverse);
+            Vector3 angular = {torque.x/(mass*body.inertia.x), torque.y/(mass*body.inertia.y), torque.z/(mass*body.inertia.z)};
+            body.angularVelocity = Vector3Add(body.angularVelocity, Vector3Scale(Vector3RotateByQuaternion(angular, body.orientation), deltaTime));
+        }
+
+        // same bounce as the particles, on the body's bounding sphere
+        if (Vector3Length(body.position) + body.radius >= sphereSize - 1.0f) {
+            if (Vector3DotProduct(body.position, body.velocity) > 0.0f) body.velocity = Vector3Scale(Vector3Reflect(body.velocity, Vector3Negate(Vector3Normalize(body.position))), 0.8f);
+        }
+        body.position = Vector3Add(body.position, Vector3Scale(body.velocity, deltaTime));
+
+        const Vector3 w = body.angularVelocity;
+        const Quaternion spin = {w.x, w.y, w.z, 0.0f};
+        body.orientation = QuaternionNormalize(QuaternionAdd(body.orientation, QuaternionScale(QuaternionMultiply(spin, body.orientation), 0.5f*deltaTime)));
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <raymath.h>
+#include <vector>
+
+enum RigidBodyShape {
+    BODY_SPHERE,
+    BODY_BOX
+};
+
+// a solid moving through the fluid, represented by samples on its surface that
+// act as boundary particles: they add to the fluid density, push back with the
+// fluid's pressure, and the reaction is summed into a force and torque on the body
+struct RigidBody {
+    RigidBodyShape shape;
+    Vector3 halfExtents;        // radius in every axis for a sphere
+    Vector3 position;
+    Quaternion orientation;
+    Vector3 velocity;
+    Vector3 angularVelocity;
+
+    float relativeDensity;      // to the fluid: below 1 floats, above 1 sinks
+    float volume;
+    Vector3 inertia;            // principal moments per unit mass, in the body frame
+    float radius;               // bounding radius, for the container
+
+    std::vector<Vector3> samples;       // body frame
+    std::vector<float> sampleVolumes;   // 1/sum of W over the other samples, at volumeRadius
+    float volumeRadius;
+
+    Vector3 force;              // from the fluid over the last step
+    Vector3 torque;
+    bool dynamic;               // false keeps the body where it is, still pushing the fluid
+};
+
+// spacing is the distance between neighboring surface samples
+RigidBody sphereBody(Vector3 center, float radius, float relativeDensity, float spacing);
+RigidBody boxBody(Vector3 center, Vector3 halfExtents, float relativeDensity, float spacing);
+
+extern std::vector<RigidBody> rigidBodies;
+
+// recomputes a body's sample volumes if the kernel radius h changed since the last time
+void updateSampleVolumes(RigidBody& body, float h);
+
+// world-space position and velocity of body sample k
+Vector3 sampleWorldPosition(const RigidBody& body, int k);
+Vector3 sampleWorldVelocity(const RigidBody& body, Vector3 worldPosition);
+
+// advances the bodies by deltaTime under their fluid force and torque plus gravity
+// and forceFields, with body mass and the external accelerations expressed in the
+// same units the fluid uses: fluidDensity per unit volume, and fluid particles
+// accelerating by externalScale (their mean mass/density) times gravity
+void integrateRigidBodies(float deltaTime, float fluidDensity, float externalScale);
@@ -0,0 +1,612 @@
+// fluid65-scaling: headless strong/weak scaling benchmark for the solver in fluid.cpp
+
+#include "fluid.h"
+#include "probes.h"
+#include "scenes.h"
+#include "validation.h"
+#include "volume.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Options {
+    std::vector<Scene> scenes;
+    std::vector<int> particleCounts;
+    std::vector<int> threadCounts;
+    int weakParticles = 250;
+    int steps = 20;
+    int warmup = 2;
+    float deltaTime = 0.03f;
+    unsigned int seed = 65;
+    bool strong = true;
+    bool weak = true;
+    std::vector<Validation> validations;
+    int validationSteps = 0;
+    double tolerance = 0.0;
+    int probeInterval = 0;
+    int probeResolution = 128;
+    ProbeFormat probeFormat = PROBE_IMAGE;
+    int volumeInterval = 0;
+    int voxelsPerRadius = 4;
+    std::string volumeDirectory = ".";
+    bool multiLevel = false;
+    int coarseRatio = 4;
+    std::string csvPath = "scaling.csv";
+    std::string jsonPath = "scaling.json";
+};
+
+struct Result {
+    const char* mode;
+    Scene scene;
+    int particles;
+    int threads;
+    int steps;
+    double seconds;
+    double stepsPerSecond;
+    double particleUpdatesPerSecond;
+    double efficiency;
+    const char* neighbors;  // list build the auto-selector settled on
+    int failedSteps;        // steps the solver could not take; the timing is void if any
+    float sphereSize;       // domain the scene was set up in
+    double pairs;           // neighbor pairs per particle, averaged over the timed steps
+};
+
+static std::vector<int> parseIntList(const char* text) {
+    std::vector<int> values;
+    const char* c = text;
+    while (*c) {
+        char* end;
+        long value = strtol(c, &end, 10);
+        if (end == c) break;
+        if (value > 0) values.push_back((int)value);
+        c = (*end == ',') ? end + 1 : end;
+    }
+    return values;
+}
+
+static std::vector<Scene> parseSceneList(const char* text) {
+    std::vector<Scene> scenes;
+    std::string list(text);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(start, end - start);
+        Scene scene;
+        if (parseScene(name.c_str(), &scene)) scenes.push_back(scene);
+        else if (!name.empty()) fprintf(stderr, "unknown scene '%s'\n", name.c_str());
+        start = end + 1;
+    }
+    return scenes;
+}
+
+static std::vector<Validation> parseValidationList(const char* text) {
+    std::vector<Validation> validations;
+    if (strcmp(text, "all") == 0) {
+        for (int v = 0; v < VALIDATION_COUNT; v++) validations.push_back((Validation)v);
+        return validations;
+    }
+    std::string list(text);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(start, end - start);
+        Validation validation;
+        if (parseValidation(name.c_str(), &validation)) validations.push_back(validation);
+        else if (!name.empty()) fprintf(stderr, "unknown validation '%s'\n", name.c_str());
+        start = end + 1;
+    }
+    return validations;
+}
+
+static void printUsage() {
+    printf("usage: fluid65-scaling [options]\n"
+           "  --scenes a,b,...      scenes to run (drop, dam, pool, layers, bodies; default all)\n"
+           "  --particles a,b,...   particle counts for strong scaling (default 500,1000,2000)\n"
+           "  --threads a,b,...     thread counts (default 1,2,4,... up to hardware threads)\n"
+           "  --weak-particles n    particles per thread for weak scaling (default 250); the\n"
+           "                        sphere grows by cbrt(threads) to keep the density\n"
+           "  --mode strong|weak|both\n"
+           "  --steps n             timed steps per run (default 20)\n"
+           "  --warmup n            untimed steps per run (default 2)\n"
+           "  --dt t                time step (default 0.03)\n"
+           "  --seed n              scene seed (default 65)\n"
+           "  --csv path            CSV output (default scaling.csv)\n"
+           "  --json path           JSON output (default scaling.json)\n"
+           "  --validate a,b,...|all  run validation scenes (hydrostatic, dam, droplet) at each\n"
+           "                        particle count instead of the scaling runs\n"
+           "  --validation-steps n  steps per validation run (default per scene)\n"
+           "  --tolerance x         relative error bar for pass/fail (default per scene)\n"
+           "  --multilevel          time the multi-level grid against a single-level grid on\n"
+           "                        a mixed-resolution lattice of each particle count instead of the scaling runs\n"
+           "  --coarse-ratio n      coarse to fine spacing and smoothing length in it (default 4)\n"
+           "  --scheduler passes|tasks  run step phases as global passes or as a tiled task graph\n"
+           "  --neighbors auto|grid|brute|sparse  neighbor list build (default auto)\n"
+           "  --tile-cells n        task graph tile edge in grid cells (default 1)\n"
+           "  --energy-drift x      alarm when total energy grows by more than x (relative)\n"
+           "  --momentum-drift x    alarm when linear/angular momentum drift by more than x (relative)\n"
+           "  --drift-abort         abort instead of logging when a drift alarm fires\n"
+           "  --probes k            sample density, pressure and velocity on the x, y and z center\n"
+           "                        slices every k steps, written in the background\n"
+           "  --probe-resolution n  samples per slice edge (default 128)\n"
+           "  --probe-format pfm|csv  float images or one CSV row per sample (default pfm)\n"
+           "  --probe-dir path      existing directory for the probe files (default .)\n"
+           "  --volumes k           splat density and velocity onto a sparse voxel grid every k\n"
+           "                        timed steps and write it as <scene>_<N>_<threads>t_<step>.f65v\n"
+           "  --voxels-per-radius n voxel size is sampleRadius/n (default 4)\n"
+           "  --volume-dir path     existing directory for the volume files (default .)\n"
+           "  --deterministic       fixed-point state and integer neighbor sums, bit-identical on any machine\n");
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            printUsage();
+            exit(0);
+        }
+        if (strcmp(arg, "--drift-abort") == 0) {
+            driftAlarm.action = DRIFT_ABORT;
+            continue;
+        }
+        if (strcmp(arg, "--deterministic") == 0) {
+            deterministicMode = true;
+            continue;
+        }
+        if (strcmp(arg, "--multilevel") == 0) {
+            options.multiLevel = true;
+            continue;
+        }
+        if (!value) {
+            fprintf(stderr, "missing value for %s\n", arg);
+            return false;
+        }
+        i++;
+        if (strcmp(arg, "--scenes") == 0) options.scenes = parseSceneList(value);
+        else if (strcmp(arg, "--particles") == 0) options.particleCounts = parseIntList(value);
+        else if (strcmp(arg, "--threads") == 0) options.threadCounts = parseIntList(value);
+        else if (strcmp(arg, "--weak-particles") == 0) options.weakParticles = atoi(value);
+        else if (strcmp(arg, "--steps") == 0) options.steps = atoi(value);
+        else if (strcmp(arg, "--warmup") == 0) options.warmup = atoi(value);
+        else if (strcmp(arg, "--dt") == 0) options.deltaTime = (float)atof(value);
+        else if (strcmp(arg, "--seed") == 0) options.seed = (unsigned int)strtoul(value, nullptr, 10);
+        else if (strcmp(arg, "--csv") == 0) options.csvPath = value;
+        else if (strcmp(arg, "--json") == 0) options.jsonPath = value;
+        else if (strcmp(arg, "--validate") == 0) options.validations = parseValidationList(value);
+        else if (strcmp(arg, "--validation-steps") == 0) options.validationSteps = atoi(value);
+        else if (strcmp(arg, "--tolerance") == 0) options.tolerance = atof(value);
+        else if (strcmp(arg, "--coarse-ratio") == 0) options.coarseRatio = atoi(value);
+        else if (strcmp(arg, "--probes") == 0) options.probeInterval = atoi(value);
+        else if (strcmp(arg, "--probe-resolution") == 0) options.probeResolution = atoi(value);
+        else if (strcmp(arg, "--probe-format") == 0) options.probeFormat = strcmp(value, "csv") == 0 ? PROBE_CSV : PROBE_IMAGE;
+        else if (strcmp(arg, "--probe-dir") == 0) probeDirectory = value;
+        else if (strcmp(arg, "--volumes") == 0) options.volumeInterval = atoi(value);
+        else if (strcmp(arg, "--voxels-per-radius") == 0) options.voxelsPerRadius = atoi(value);
+        else if (strcmp(arg, "--volume-dir") == 0) options.volumeDirectory = value;
+        else if (strcmp(arg, "--scheduler") == 0) stepScheduler = strcmp(value, "tasks") == 0 ? SCHEDULER_TASK_GRAPH : SCHEDULER_PASSES;
+        else if (strcmp(arg, "--neighbors") == 0) {
+            if (strcmp(value, "grid") == 0) neighborSearch = NEIGHBOR_SEARCH_GRID;
+            else if (strcmp(value, "brute") == 0) neighborSearch = NEIGHBOR_SEARCH_BRUTE_FORCE;
+            else if (strcmp(value, "sparse") == 0) neighborSearch = NEIGHBOR_SEARCH_SPARSE_GRID;
+            else neighborSearch = NEIGHBOR_SEARCH_AUTO;
+        } else if (strcmp(arg, "--tile-cells") == 0) cellsPerTile = atoi(value);
+        else if (strcmp(arg, "--energy-drift") == 0) driftAlarm.energyTolerance = atof(value);
+        else if (strcmp(arg, "--momentum-drift") == 0) driftAlarm.momentumTolerance = atof(value);
+        else if (strcmp(arg, "--mode") == 0) {
+            options.strong = strcmp(value, "weak") != 0;
+            options.weak = strcmp(value, "strong") != 0;
+        } else {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return false;
+        }
+    }
+
+    if (options.scenes.empty()) {
+        for (int s = 0; s < SCENE_COUNT; s++) options.scenes.push_back((Scene)s);
+    }
+    if (options.particleCounts.empty()) options.particleCounts = {500, 1000, 2000};
+    if (options.threadCounts.empty()) {
+        int hardwareThreads = (int)std::thread::hardware_concurrency();
+        if (hardwareThreads < 1) hardwareThreads = 1;
+        for (int t = 1; t < hardwareThreads; t *= 2) options.threadCounts.push_back(t);
+        options.threadCounts.push_back(hardwareThreads);
+    }
+    if (options.steps < 1 || options.weakParticles < 1 || options.coarseRatio < 1 || options.voxelsPerRadius < 1) {
+        fprintf(stderr, "--steps, --weak-particles, --coarse-ratio and --voxels-per-radius must be positive\n");
+        return false;
+    }
+    return true;
+}
+
+// the volume export is part of the timed run, as it would be in production
+static void writeVolume(Scene scene, int count, int threads, int step, const Options& options) {
+    static VoxelVolume volume;
+    rasterizeParticles(volume, sampleRadius/options.voxelsPerRadius);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s_%d_%dt_%06d.f65v", options.volumeDirectory.c_str(), sceneName(scene), count, threads, step);
+    if (!writeVoxelVolume(path, volume, 1e-3f*restDensity)) fprintf(stderr, "failed to write %s\n", path);
+}
+
+// neighbor pairs per particle over the timed steps of the last runScene
+static double scenePairs = 0.0;
+
+static double runScene(Scene scene, int count, int threads, const Options& options) {
+    setThreadCount(threads);
+    setupScene(scene, count, options.seed);
+    probes.clear();
+    if (options.probeInterval > 0) {
+        // one set of files per run, named after it
+        char name[64];
+        for (int axis = 0; axis < 3; axis++) {
+            snprintf(name, sizeof(name), "%s_%d_%dt_%c", sceneName(scene), count, threads, "xyz"[axis]);
+            probes.push_back(sliceProbe(name, axis, 0.0f, options.probeResolution, options.probeInterval, options.probeFormat));
+        }
+    }
+    for (int i = 0; i < options.warmup; i++) updateParticles(options.deltaTime);
+
+    auto start = std::chrono::steady_clock::now();
+    long long pairs = 0;
+    for (int i = 0; i < options.steps; i++) {
+        updateParticles(options.deltaTime);
+        pairs += (long long)particleNeighbors.index.size();
+        if (options.volumeInterval > 0 && (i + 1) % options.volumeInterval == 0) writeVolume(scene, count, threads, i + 1, options);
+    }
+    auto end = std::chrono::steady_clock::now();
+    scenePairs = count > 0 ? (double)pairs/((double)count*options.steps) : 0.0;
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static Result makeResult(const char* mode, Scene scene, int count, int threads, double seconds, const Options& options) {
+    Result result;
+    result.mode = mode;
+    result.scene = scene;
+    result.particles = count;
+    result.threads = threads;
+    result.steps = options.steps;
+    result.seconds = seconds;
+    result.stepsPerSecond = options.steps/seconds;
+    result.particleUpdatesPerSecond = (double)count*options.steps/seconds;
+    result.efficiency = 1.0;
+    static const char* searchNames[] = { "auto", "grid", "brute", "sparse" };
+    result.neighbors = searchNames[activeNeighborSearch()];
+    result.failedSteps = diagnostics.failedSteps;
+    result.sphereSize = sphereSize;
+    result.pairs = scenePairs;
+    return result;
+}
+
+static void printResult(const Result& r) {
+    printf("%-6s %-6s %8d %7d %10.3f %12.2f %14.4g %10.3f %9s %6d\n",
+           r.mode, sceneName(r.scene), r.particles, r.threads, r.seconds,
+           r.stepsPerSecond, r.particleUpdatesPerSecond, r.efficiency, r.neighbors, r.failedSteps);
+}
+
+static bool writeCsv(const std::string& path, const std::vector<Result>& results) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "mode,scene,particles,threads,steps,seconds,steps_per_second,particle_updates_per_second,parallel_efficiency,neighbors,failed_steps,sphere_size,pairs_per_particle\n");
+    for (const Result& r : results) {
+        fprintf(file, "%s,%s,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%s,%d,%g,%.3f\n",
+                r.mode, sceneName(r.scene), r.particles, r.threads, r.steps,
+                r.seconds, r.stepsPerSecond, r.particleUpdatesPerSecond, r.efficiency, r.neighbors, r.failedSteps, r.sphereSize, r.pairs);
+    }
+    fclose(file);
+    return true;
+}
+
+static bool writeJson(const std::string& path, const std::vector<Result>& results, const Options& options) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "{\n  \"hardware_threads\": %u,\n  \"scheduler\": \"%s\",\n  \"dt\": %g,\n  \"seed\": %u,\n  \"results\": [\n",
+            std::thread::hardware_concurrency(), stepScheduler == SCHEDULER_TASK_GRAPH ? "tasks" : "passes",
+            options.deltaTime, options.seed);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(file, "    {\"mode\": \"%s\", \"scene\": \"%s\", \"particles\": %d, \"threads\": %d, \"steps\": %d, "
+                      "\"seconds\": %.6f, \"steps_per_second\": %.6f, \"particle_updates_per_second\": %.6f, "
+                      "\"parallel_efficiency\": %.6f, \"neighbors\": \"%s\", \"failed_steps\": %d, \"sphere_size\": %g, \"pairs_per_particle\": %.3f}%s\n",
+                r.mode, sceneName(r.scene), r.particles, r.threads, r.steps, r.seconds,
+                r.stepsPerSecond, r.particleUpdatesPerSecond, r.efficiency, r.neighbors, r.failedSteps, r.sphereSize, r.pairs,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+static bool writeValidationCsv(const std::string& path, const std::vector<ValidationResult>& results, int threads) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "validation,particles,threads,steps,seconds,steps_per_second,particle_updates_per_second,measured,expected,error,tolerance,failed_steps,failure,passed\n");
+    for (const ValidationResult& r : results) {
+        fprintf(file, "%s,%d,%d,%d,%.6f,%.6f,%.6f,%.6g,%.6g,%.6f,%.6f,%d,%s,%d\n",
+                validationName(r.validation), r.particles, threads, r.steps, r.seconds,
+                r.steps/r.seconds, (double)r.particles*r.steps/r.seconds,
+                r.measured, r.expected, r.error, r.tolerance, r.failedSteps, r.failure ? r.failure : "", r.passed ? 1 : 0);
+    }
+    fclose(file);
+    return true;
+}
+
+static bool writeValidationJson(const std::string& path, const std::vector<ValidationResult>& results, int threads, const Options& options) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "{\n  \"hardware_threads\": %u,\n  \"threads\": %d,\n  \"dt\": %g,\n  \"seed\": %u,\n  \"validations\": [\n",
+            std::thread::hardware_concurrency(), threads, options.deltaTime, options.seed);
+    for (size_t i = 0; i < results.size(); i++) {
+        const ValidationResult& r = results[i];
+        // JSON has no NaN; a run that measured nothing has null there and says why
+        char measured[32] = "null", error[32] = "null", failure[64] = "null";
+        if (std::isfinite(r.measured)) snprintf(measured, sizeof(measured), "%.6g", r.measured);
+        if (std::isfinite(r.error)) snprintf(error, sizeof(error), "%.6f", r.error);
+        if (r.failure) snprintf(failure, sizeof(failure), "\"%s\"", r.failure);
+        fprintf(file, "    {\"validation\": \"%s\", \"particles\": %d, \"steps\": %d, \"seconds\": %.6f, "
+                      "\"steps_per_second\": %.6f, \"particle_updates_per_second\": %.6f, "
+                      "\"measured\": %s, \"expected\": %.6g, \"error\": %s, \"tolerance\": %.6f, \"failed_steps\": %d, "
+                      "\"failure\": %s, \"passed\": %s}%s\n",
+                validationName(r.validation), r.particles, r.steps, r.seconds,
+                r.steps/r.seconds, (double)r.particles*r.steps/r.seconds,
+                measured, r.expected, error, r.tolerance, r.failedSteps, failure, r.passed ? "true" : "false",
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+// error versus cost: every validation at every particle count, on the largest thread count
+static int runValidations(const Options& options) {
+    int threads = 1;
+    for (int t : options.threadCounts) threads = t > threads ? t : threads;
+    setThreadCount(threads);
+
+    std::vector<ValidationResult> results;
+    bool allPassed = true;
+    printf("%-11s %8s %6s %10s %14s %12s %12s %8s %6s %6s\n",
+           "validation", "N", "steps", "seconds", "updates/s", "measured", "expected", "error", "failed", "pass");
+    for (Validation validation : options.validations) {
+        int steps = options.validationSteps > 0 ? options.validationSteps : defaultValidationSteps(validation);
+        double tolerance = options.tolerance > 0.0 ? options.tolerance : defaultValidationTolerance(validation);
+        for (int count : options.particleCounts) {
+            ValidationResult r = runValidation(validation, count, steps, options.deltaTime, options.seed, tolerance);
+            printf("%-11s %8d %6d %10.3f %14.4g %12.4g %12.4g %8.3f %6d %6s %s\n",
+                   validationName(r.validation), r.particles, r.steps, r.seconds,
+                   (double)r.particles*r.steps/r.seconds, r.measured, r.expected, r.error,
+                   r.failedSteps, r.passed ? "yes" : "no", r.failure ? r.failure : "");
+            allPassed = allPassed && r.passed;
+            results.push_back(r);
+        }
+    }
+
+    if (!writeValidationCsv(options.csvPath, results, threads)) fprintf(stderr, "failed to write %s\n", options.csvPath.c_str());
+    if (!writeValidationJson(options.jsonPath, results, threads, options)) fprintf(stderr, "failed to write %s\n", options.jsonPath.c_str());
+    return allPassed ? 0 : 2;
+}
+
+struct MultiLevelResult {
+    int particles;
+    int coarse;
+    double singleSeconds;   // per list build, grid included
+    double multiSeconds;
+    long long pairs;
+    bool match;
+};
+
+// a jittered lattice over [-1, 1]^3, count points in all: fine where x < 0 and
+// coarseRatio times coarser where x >= 0, each point's radius twice its spacing,
+// so both halves see about the same number of neighbors
+static void mixedResolution(int count, const Options& options, std::vector<Vector3>& positions, std::vector<float>& radii, int& coarse) {
+    std::default_random_engine generator(options.seed);
+    std::uniform_real_distribution<float> jitter(-0.25f, 0.25f);
+    const float ratio3 = (float)(options.coarseRatio*options.coarseRatio*options.coarseRatio);
+    const float fine = cbrtf(4.0f/(count*ratio3/(ratio3 + 1.0f)));
+    positions.clear();
+    radii.clear();
+    coarse = 0;
+    for (int half = 0; half < 2; half++) {
+        const float spacing = half == 0 ? fine : fine*options.coarseRatio;
+        for (float x = half - 1.0f + 0.5f*spacing; x < half; x += spacing) {
+            for (float y = -1.0f + 0.5f*spacing; y < 1.0f; y += spacing) {
+                for (float z = -1.0f + 0.5f*spacing; z < 1.0f; z += spacing) {
+                    positions.push_back({x + jitter(generator)*spacing, y + jitter(generator)*spacing, z + jitter(generator)*spacing});
+                    radii.push_back(2.0f*spacing);
+                    coarse += half;
+                }
+            }
+        }
+    }
+}
+
+// what a single-level grid has to do: cells as wide as the largest radius, then
+// every candidate within it filtered down to the pair's own radius
+static void buildSingleLevel(NeighborList& list, UniformGrid& grid, NeighborList& candidates, const std::vector<Vector3>& positions, const std::vector<float>& radii) {
+    const int count = (int)positions.size();
+    float maxRadius = 0.0f;
+    for (float r : radii) maxRadius = r > maxRadius ? r : maxRadius;
+    buildGrid(grid, positions.data(), count, sizeof(Vector3), maxRadius, 0);
+    buildNeighborList(candidates, grid, positions.data(), count, sizeof(Vector3), maxRadius);
+
+    list.start.assign(count + 1, 0);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        int n = 0;
+        for (int k = candidates.start[i]; k < candidates.start[i + 1]; k++) {
+            const int j = candidates.index[k];
+            const float r = radii[i] > radii[j] ? radii[i] : radii[j];
+            n += Vector3DistanceSqr(positions[i], positions[j]) <= r*r;
+        }
+        list.start[i + 1] = n;
+    }
+    for (int i = 0; i < count; i++) list.start[i + 1] += list.start[i];
+
+    list.index.resize(list.start[count]);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < count; i++) {
+        int n = list.start[i];
+        for (int k = candidates.start[i]; k < candidates.start[i + 1]; k++) {
+            const int j = candidates.index[k];
+            const float r = radii[i] > radii[j] ? radii[i] : radii[j];
+            if (Vector3DistanceSqr(positions[i], positions[j]) <= r*r) list.index[n++] = j;
+        }
+    }
+}
+
+static bool sameNeighbors(const NeighborList& a, const NeighborList& b) {
+    if (a.start != b.start) return false;
+    for (size_t i = 0; i + 1 < a.start.size(); i++) {
+        std::vector<int> x(a.index.begin() + a.start[i], a.index.begin() + a.start[i + 1]);
+        std::vector<int> y(b.index.begin() + b.start[i], b.index.begin() + b.start[i + 1]);
+        std::sort(x.begin(), x.end());
+        std::sort(y.begin(), y.end());
+        if (x != y) return false;
+    }
+    return true;
+}
+
+static int runMultiLevel(const Options& options) {
+    int threads = 1;
+    for (int t : options.threadCounts) threads = t > threads ? t : threads;
+    setThreadCount(threads);
+
+    std::vector<MultiLevelResult> results;
+    bool allMatch = true;
+    printf("%8s %7s %12s %12s %8s %12s %6s\n", "N", "coarse", "single ms", "multi ms", "speedup", "pairs", "match");
+    for (int count : options.particleCounts) {
+        MultiLevelResult r;
+        std::vector<Vector3> positions;
+        std::vector<float> radii;
+        mixedResolution(count, options, positions, radii, r.coarse);
+        r.particles = (int)positions.size();
+
+        UniformGrid grid;
+        MultiLevelGrid levels;
+        NeighborList single, multi, candidates;
+        for (int i = 0; i < options.warmup; i++) {
+            buildSingleLevel(single, grid, candidates, positions, radii);
+            buildMultiLevelGrid(levels, positions.data(), radii.data(), r.particles, sizeof(Vector3));
+            buildNeighborList(multi, levels, positions.data(), radii.data(), r.particles, sizeof(Vector3));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < options.steps; i++) buildSingleLevel(single, grid, candidates, positions, radii);
+        auto middle = std::chrono::steady_clock::now();
+        for (int i = 0; i < options.steps; i++) {
+            buildMultiLevelGrid(levels, positions.data(), radii.data(), r.particles, sizeof(Vector3));
+            buildNeighborList(multi, levels, positions.data(), radii.data(), r.particles, sizeof(Vector3));
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        r.singleSeconds = std::chrono::duration<double>(middle - start).count()/options.steps;
+        r.multiSeconds = std::chrono::duration<double>(end - middle).count()/options.steps;
+        r.pairs = (long long)multi.index.size();
+        r.match = sameNeighbors(single, multi);
+        allMatch = allMatch && r.match;
+        printf("%8d %7d %12.3f %12.3f %8.2f %12lld %6s\n", r.particles, r.coarse,
+               r.singleSeconds*1e3, r.multiSeconds*1e3, r.singleSeconds/r.multiSeconds, r.pairs, r.match ? "yes" : "no");
+        results.push_back(r);
+    }
+
+    FILE* file = fopen(options.csvPath.c_str(), "w");
+    if (file) {
+        fprintf(file, "particles,coarse,coarse_ratio,threads,single_seconds,multi_seconds,speedup,pairs,match\n");
+        for (const MultiLevelResult& r : results) {
+            fprintf(file, "%d,%d,%d,%d,%.6f,%.6f,%.6f,%lld,%d\n", r.particles, r.coarse, options.coarseRatio,
+                    threads, r.singleSeconds, r.multiSeconds, r.singleSeconds/r.multiSeconds, r.pairs, r.match ? 1 : 0);
+        }
+        fclose(file);
+    } else {
+        fprintf(stderr, "failed to write %s\n", options.csvPath.c_str());
+    }
+
+    file = fopen(options.jsonPath.c_str(), "w");
+    if (file) {
+        fprintf(file, "{\n  \"hardware_threads\": %u,\n  \"threads\": %d,\n  \"coarse_ratio\": %d,\n  \"seed\": %u,\n  \"multilevel\": [\n",
+                std::thread::hardware_concurrency(), threads, options.coarseRatio, options.seed);
+        for (size_t i = 0; i < results.size(); i++) {
+            const MultiLevelResult& r = results[i];
+            fprintf(file, "    {\"particles\": %d, \"coarse\": %d, \"single_seconds\": %.6f, "
+                          "\"multi_seconds\": %.6f, \"speedup\": %.6f, \"pairs\": %lld, \"match\": %s}%s\n",
+                    r.particles, r.coarse, r.singleSeconds, r.multiSeconds,
+                    r.singleSeconds/r.multiSeconds, r.pairs, r.match ? "true" : "false", i + 1 < results.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+        fclose(file);
+    } else {
+        fprintf(stderr, "failed to write %s\n", options.jsonPath.c_str());
+    }
+    return allMatch ? 0 : 2;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+    if (!options.validations.empty()) return runValidations(options);
+    if (options.multiLevel) return runMultiLevel(options);
+
+    std::vector<Result> results;
+    printf("%-6s %-6s %8s %7s %10s %12s %14s %10s %9s %6s\n",
+           "mode", "scene", "N", "threads", "seconds", "steps/s", "updates/s", "efficiency", "neighbors", "failed");
+    bool allStepped = true;
+
+    for (Scene scene : options.scenes) {
+        // strong scaling: fixed problem size, efficiency relative to the first thread count
+        if (options.strong) {
+            for (int count : options.particleCounts) {
+                double baseline = 0.0;
+                int baselineThreads = 0;
+                for (int threads : options.threadCounts) {
+                    Result r = makeResult("strong", scene, count, threads, runScene(scene, count, threads, options), options);
+                    if (baselineThreads == 0) {
+                        baseline = r.seconds;
+                        baselineThreads = threads;
+                    }
+                    r.efficiency = (baseline*baselineThreads)/(r.seconds*threads);
+                    allStepped = allStepped && r.failedSteps == 0;
+                    printResult(r);
+                    results.push_back(r);
+                }
+            }
+        }
+
+        // weak scaling: problem size grows with the thread count, and the domain with
+        // it by cbrt(threads) so the particle spacing stays that of the one-thread run.
+        // What the domain can't hold constant (the free surface share, a drop smaller
+        // than the kernel) shows up in the neighbor pairs, so efficiency is per pair.
+        if (options.weak) {
+            const float baseSphereSize = sphereSize;
+            double baseline = 0.0, baselinePairs = 0.0;
+            for (int threads : options.threadCounts) {
+                int count = options.weakParticles*threads;
+                sphereSize = baseSphereSize*cbrtf((float)threads);
+                Result r = makeResult("weak", scene, count, threads, runScene(scene, count, threads, options), options);
+                if (baseline == 0.0) {
+                    baseline = r.seconds;
+                    baselinePairs = r.pairs;
+                }
+                r.efficiency = baselinePairs > 0.0 ? (baseline*r.pairs)/(r.seconds*baselinePairs) : baseline/r.seconds;
+                allStepped = allStepped && r.failedSteps == 0;
+                printResult(r);
+                results.push_back(r);
+            }
+            sphereSize = baseSphereSize;
+        }
+    }
+
+    flushProbes();
+    if (!writeCsv(options.csvPath, results)) fprintf(stderr, "failed to write %s\n", options.csvPath.c_str());
+    if (!writeJson(options.jsonPath, results, options)) fprintf(stderr, "failed to write %s\n", options.jsonPath.c_str());
+    return allStepped ? 0 : 2;
+}
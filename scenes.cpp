@@ -0,0 +1,110 @@
+#include "scenes.h"
+
+#include "fluid.h"
+#include "probes.h"
+#include "rigidbody.h"
+#include "secondary.h"
+
+#include <cstring>
+#include <random>
+
+static const char* sceneNames[SCENE_COUNT] = { "drop", "dam", "pool", "layers", "bodies" };
+
+const char* sceneName(Scene scene) {
+    if (scene < 0 || scene >= SCENE_COUNT) return "unknown";
+    return sceneNames[scene];
+}
+
+bool parseScene(const char* name, Scene* scene) {
+    for (int i = 0; i < SCENE_COUNT; i++) {
+        if (strcmp(name, sceneNames[i]) == 0) {
+            *scene = (Scene)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// uniform samples in the box [lo, hi], rejected if they fall outside the sphere
+static Vector3 sampleBoxInSphere(std::default_random_engine& generator, Vector3 lo, Vector3 hi) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const float limit = sphereSize - 2.0f;
+    while (true) {
+        Vector3 p = {
+            lo.x + (hi.x - lo.x)*unit(generator),
+            lo.y + (hi.y - lo.y)*unit(generator),
+            lo.z + (hi.z - lo.z)*unit(generator)
+        };
+        if (Vector3Length(p) < limit) return p;
+    }
+}
+
+static bool insideBody(Vector3 p) {
+    for (const RigidBody& body : rigidBodies) {
+        if (Vector3Distance(p, body.position) < body.radius) return true;
+    }
+    return false;
+}
+
+void setupScene(Scene scene, int count, unsigned int seed) {
+    std::default_random_engine generator(seed);
+    const float R = sphereSize;
+    std::normal_distribution<float> distribution(0.0f, 0.125f*R);
+
+    fluidPhases.clear();
+    if (scene == SCENE_LAYERS) {
+        FluidPhase water = makeFluidPhase(restDensity, viscosity, surfaceTension);
+        FluidPhase oil = makeFluidPhase(0.8f*restDensity, 5.0f*viscosity, 0.5f*surfaceTension);
+        water.interfaceTension[1] = oil.interfaceTension[0] = 0.4f*surfaceTension;
+        fluidPhases.push_back(water);
+        fluidPhases.push_back(oil);
+    }
+
+    rigidBodies.clear();
+    clearSecondaryParticles();
+    restartProbes();
+    if (scene == SCENE_BODIES) {
+        rigidBodies.push_back(sphereBody({-0.3f*R, -0.7f*R, 0.0f}, 0.2f*R, 0.4f, 3.0f));
+        rigidBodies.push_back(boxBody({0.3f*R, 0.1f*R, 0.0f}, {0.15f*R, 0.1f*R, 0.15f*R}, 3.0f, 3.0f));
+    }
+
+    particles.assign(count, Particle());
+    for (int i = 0; i < count; i++) {
+        Particle& p = particles[i];
+        p.phase = 0;
+        switch (scene) {
+            case SCENE_DAM_BREAK:
+                p.position = sampleBoxInSphere(generator, {-R, -R, -0.5f*R}, {-0.2f*R, 0.3f*R, 0.5f*R});
+                break;
+            case SCENE_POOL:
+                p.position = sampleBoxInSphere(generator, {-R, -R, -R}, {R, -0.4f*R, R});
+                break;
+            case SCENE_BODIES:
+                // keep the fluid out of the bodies, whose samples only cover their surfaces
+                do p.position = sampleBoxInSphere(generator, {-R, -R, -R}, {R, -0.4f*R, R});
+                while (insideBody(p.position));
+                break;
+            case SCENE_LAYERS:
+                // first half water at the bottom, second half a lighter oil layer released above it
+                if (i < count/2) {
+                    p.position = sampleBoxInSphere(generator, {-R, -R, -R}, {R, -0.5f*R, R});
+                } else {
+                    p.position = sampleBoxInSphere(generator, {-0.6f*R, -0.2f*R, -0.6f*R}, {0.6f*R, 0.2f*R, 0.6f*R});
+                    p.phase = 1;
+                }
+                break;
+            case SCENE_DROP:
+            default:
+                p.position = {distribution(generator), distribution(generator), distribution(generator)};
+                break;
+        }
+        p.velocity = Vector3Zero();
+        p.acceleration = Vector3Zero();
+        p.mass = p.phase == 1 ? 0.8f : 1.0f;
+        p.density = 0.0f;
+        p.pressure = 0.0f;
+        p.colorGradient = Vector3Zero();
+    }
+    invalidateParticleGrid();
+    resetDiagnostics();
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+enum Scene {
+    SCENE_DROP,       // gaussian blob released in the middle of the sphere
+    SCENE_DAM_BREAK,  // column of fluid against one side of the sphere
+    SCENE_POOL,       // fluid resting in the bottom of the sphere
+    SCENE_LAYERS,     // oil poured over water, two phases
+    SCENE_BODIES,     // pool with a light ball floating up and a heavy box sinking
+    SCENE_COUNT
+};
+
+const char* sceneName(Scene scene);
+bool parseScene(const char* name, Scene* scene);
+
+// replaces the contents of particles with count particles laid out for scene,
+// and installs the scene's phase table (empty for single-phase scenes) and rigidBodies
+void setupScene(Scene scene, int count, unsigned int seed);
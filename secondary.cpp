@@ -0,0 +1,202 @@
+#include "secondary.h"
+
+#include "fluid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+SecondaryParticles secondaryParticles;
+SecondarySettings secondarySettings = {
+    false, 200000,
+    500.0f, 2000.0f,
+    5.0f, 20.0f,
+    50.0f, 500.0f,
+    1.2f,
+    10.0f, 10.0f,
+    5.0f,
+    15, 120,
+    2.0f, 0.5f
+};
+
+static std::vector<int> spawnStart;
+static NeighborList secondaryNeighbors;
+static uint32_t spawnStep = 0;
+
+void clearSecondaryParticles() {
+    secondaryParticles.positions.clear();
+    secondaryParticles.velocities.clear();
+    secondaryParticles.lifetimes.clear();
+    secondaryParticles.types.clear();
+}
+
+// the clamping function Phi of the paper
+static inline float indicator(float value, float lo, float hi) {
+    return (fminf(value, hi) - fminf(value, lo))/(hi - lo);
+}
+
+// a counter-based generator, so spawning does not depend on the thread that ran particle i
+static inline uint32_t hash(uint32_t x) {
+    x ^= x >> 16; x *= 0x7feb352dU;
+    x ^= x >> 15; x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline float random01(uint32_t& state) {
+    state = hash(state + 0x9e3779b9U);
+    return (state >> 8)*(1.0f/16777216.0f);
+}
+
+static inline Vector3 surfaceNormal(const Particle& particle) {
+    return Vector3Normalize(Vector3Negate(particle.colorGradient));
+}
+
+// expected number of secondary particles spawned by particles[i] over deltaTime.
+// The neighbor list is from before the fluid moved, so pairs are range checked again.
+static float spawnRate(int i) {
+    const SecondarySettings& settings = secondarySettings;
+    const Particle& particle = particles[i];
+    const float h = sampleRadius;
+
+    const bool surface = Vector3Length(particle.colorGradient)*h > settings.surfaceThreshold;
+    const Vector3 normal = surfaceNormal(particle);
+
+    float trappedAir = 0.0f, curvature = 0.0f;
+    for (int k = particleNeighbors.start[i]; k < particleNeighbors.start[i + 1]; k++) {
+        const Particle& other = particles[particleNeighbors.index[k]];
+        Vector3 r = Vector3Subtract(particle.position, other.position);
+        float distance = Vector3Length(r);
+        if (distance <= 0.0f || distance >= h) continue;
+        float weight = 1.0f - distance/h;
+
+        Vector3 v = Vector3Subtract(particle.velocity, other.velocity);
+        float speed = Vector3Length(v);
+        if (speed > 0.0f) trappedAir += speed*(1.0f - Vector3DotProduct(v, r)/(speed*distance))*weight;
+
+        // only neighbors behind the surface count towards its curvature
+        if (surface && Vector3DotProduct(r, normal) > 0.0f) curvature += (1.0f - Vector3DotProduct(normal, surfaceNormal(other)))*weight;
+    }
+
+    float crest = 0.0f;
+    if (surface && Vector3DotProduct(Vector3Normalize(particle.velocity), normal) >= 0.6f) crest = curvature;
+
+    const float energy = 0.5f*particle.mass*Vector3LengthSqr(particle.velocity);
+    return indicator(energy, settings.kineticEnergyMin, settings.kineticEnergyMax)*
+        (settings.trappedAirRate*indicator(trappedAir, settings.trappedAirMin, settings.trappedAirMax) +
+         settings.waveCrestRate*indicator(crest, settings.waveCrestMin, settings.waveCrestMax));
+}
+
+// in a cylinder around the particle along its velocity, as in the paper
+static void spawn(int i, int s, uint32_t& state, float deltaTime) {
+    const Particle& particle = particles[i];
+    const float speed = Vector3Length(particle.velocity);
+    Vector3 axis = speed > 0.0f ? Vector3Scale(particle.velocity, 1.0f/speed) : Vector3{0.0f, 1.0f, 0.0f};
+    Vector3 e1 = Vector3Normalize(Vector3Perpendicular(axis));
+    Vector3 e2 = Vector3CrossProduct(axis, e1);
+
+    float radius = 0.5f*sampleRadius*sqrtf(random01(state));
+    float angle = 2.0f*PI*random01(state);
+    float along = speed*deltaTime*random01(state);
+    Vector3 offset = Vector3Add(Vector3Scale(e1, radius*cosf(angle)), Vector3Scale(e2, radius*sinf(angle)));
+
+    secondaryParticles.positions[s] = Vector3Add(Vector3Add(particle.position, offset), Vector3Scale(axis, along));
+    secondaryParticles.velocities[s] = Vector3Add(particle.velocity, offset);
+    secondaryParticles.lifetimes[s] = secondarySettings.lifetime;
+    secondaryParticles.types[s] = SECONDARY_SPRAY;
+}
+
+void updateSecondaryParticles(float deltaTime) {
+    const SecondarySettings& settings = secondarySettings;
+    SecondaryParticles& pool = secondaryParticles;
+    const int numParticles = (int)particles.size();
+    if (numParticles == 0 || (int)particleNeighbors.start.size() != numParticles + 1) {
+        clearSecondaryParticles();
+        return;
+    }
+
+    // bulk spawn: counts per fluid particle, one resize, then every particle fills its own range
+    spawnStep++;
+    spawnStart.assign(numParticles + 1, 0);
+    double massOverDensity = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:massOverDensity)
+    for (int i = 0; i < numParticles; i++) {
+        uint32_t state = hash(spawnStep*0x9e3779b1U ^ hash((uint32_t)i));
+        float expected = spawnRate(i)*deltaTime;
+        spawnStart[i + 1] = (int)(expected + random01(state));
+        massOverDensity += particles[i].mass/particles[i].density;
+    }
+    for (int i = 0; i < numParticles; i++) spawnStart[i + 1] += spawnStart[i];
+
+    const int existing = pool.size();
+    const int spawned = std::min(spawnStart[numParticles], std::max(settings.maxParticles - existing, 0));
+    pool.positions.resize(existing + spawned);
+    pool.velocities.resize(existing + spawned);
+    pool.lifetimes.resize(existing + spawned);
+    pool.types.resize(existing + spawned);
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < numParticles; i++) {
+        if (spawnStart[i] >= spawned) continue;
+        uint32_t state = hash(spawnStep*0x85ebca6bU ^ hash((uint32_t)i));
+        const int last = std::min(spawnStart[i + 1], spawned);
+        for (int s = spawnStart[i]; s < last; s++) spawn(i, existing + s, state, deltaTime);
+    }
+
+    // the fluid falls at gravity times its mass/density, so the secondaries do too
+    const Vector3 fall = {0.0f, -gravity*(float)(massOverDensity/numParticles), 0.0f};
+    const float h2 = sampleRadius*sampleRadius;
+    const int count = pool.size();
+    queryParticles(secondaryNeighbors, pool.positions.data(), count, sizeof(Vector3), sampleRadius);
+
+    #pragma omp parallel for schedule(static)
+    for (int s = 0; s < count; s++) {
+        const Vector3 p = pool.positions[s];
+        Vector3 fluidVelocity = Vector3Zero();
+        float weights = 0.0f;
+        for (int k = secondaryNeighbors.start[s]; k < secondaryNeighbors.start[s + 1]; k++) {
+            const Particle& other = particles[secondaryNeighbors.index[k]];
+            float d = h2 - Vector3DistanceSqr(p, other.position);
+            float weight = d*d*d;
+            fluidVelocity = Vector3Add(fluidVelocity, Vector3Scale(other.velocity, weight));
+            weights += weight;
+        }
+        if (weights > 0.0f) fluidVelocity = Vector3Scale(fluidVelocity, 1.0f/weights);
+
+        const int neighbors = secondaryNeighbors.start[s + 1] - secondaryNeighbors.start[s];
+        Vector3 v = pool.velocities[s];
+        if (neighbors < settings.sprayNeighbors) {
+            pool.types[s] = SECONDARY_SPRAY;
+            v = Vector3Add(v, Vector3Scale(fall, deltaTime));
+        } else if (neighbors > settings.bubbleNeighbors) {
+            pool.types[s] = SECONDARY_BUBBLE;
+            v = Vector3Add(v, Vector3Scale(fall, -settings.buoyancy*deltaTime));
+            v = Vector3Add(v, Vector3Scale(Vector3Subtract(fluidVelocity, v), settings.drag));
+        } else {
+            pool.types[s] = SECONDARY_FOAM;
+            v = fluidVelocity;
+        }
+        pool.lifetimes[s] -= deltaTime;
+        pool.velocities[s] = v;
+        pool.positions[s] = Vector3Add(p, Vector3Scale(v, deltaTime));
+    }
+
+    // bulk kill: anything faded out, that reached the container or went non-finite
+    int kept = 0;
+    for (int s = 0; s < count; s++) {
+        const Vector3 p = pool.positions[s];
+        const float sum = p.x + p.y + p.z;
+        if (pool.lifetimes[s] <= 0.0f || sum - sum != 0.0f || Vector3LengthSqr(p) >= sphereSize*sphereSize) continue;
+        if (kept != s) {
+            pool.positions[kept] = pool.positions[s];
+            pool.velocities[kept] = pool.velocities[s];
+            pool.lifetimes[kept] = pool.lifetimes[s];
+            pool.types[kept] = pool.types[s];
+        }
+        kept++;
+    }
+    pool.positions.resize(kept);
+    pool.velocities.resize(kept);
+    pool.lifetimes.resize(kept);
+    pool.types.resize(kept);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <raymath.h>
+#include <vector>
+
+// Ihmsen et al. 2012, "Unified spray, foam and air bubbles for particle-based fluids"
+enum SecondaryType {
+    SECONDARY_SPRAY,    // few fluid neighbors: ballistic
+    SECONDARY_FOAM,     // on the surface: carried along with the fluid, fades out
+    SECONDARY_BUBBLE    // inside the fluid: rises and is dragged along
+};
+
+// one array per attribute, index s across all of them is one secondary particle
+struct SecondaryParticles {
+    std::vector<Vector3> positions;
+    std::vector<Vector3> velocities;
+    std::vector<float> lifetimes;
+    std::vector<unsigned char> types;
+
+    int size() const { return (int)positions.size(); }
+};
+
+struct SecondarySettings {
+    bool enabled;
+    int maxParticles;
+    // indicator ranges mapped linearly onto [0, 1]
+    float trappedAirMin, trappedAirMax;
+    float waveCrestMin, waveCrestMax;
+    float kineticEnergyMin, kineticEnergyMax;
+    float surfaceThreshold;             // |color gradient|*sampleRadius above which a particle is on the surface
+    float trappedAirRate, waveCrestRate;    // spawned per fluid particle per unit time at full indicators
+    float lifetime;                     // secondaries fade out after this long
+    int sprayNeighbors, bubbleNeighbors;    // fewer is spray, more is bubble, between is foam
+    float buoyancy, drag;
+};
+
+extern SecondaryParticles secondaryParticles;
+extern SecondarySettings secondarySettings;
+
+void clearSecondaryParticles();
+
+// spawns from the fluid particles' indicators, then advects and retires the pool;
+// reads the neighbor list and grid of the fluid step just taken
+void updateSecondaryParticles(float deltaTime);
@@ -5,6 +5,7 @@ in vec3 fragPosition;
 in vec2 fragTexCoord;
 //in vec4 fragColor;
 in vec3 fragNormal;
+flat in float fragValue;      // per particle: its phase, or the field being mapped
 
 // Input uniform values
 uniform sampler2D texture0;
@@ -16,6 +17,24 @@ out vec4 finalColor;
 uniform vec4 ambient;
 uniform vec3 viewPos;
 
+// colorMode 0 colors by phase, 1 maps fragValue from valueRange through the colormap
+uniform int colorMode;
+uniform vec4 phaseColors[4];
+uniform vec2 valueRange;
+
+// polynomial fit of matplotlib's viridis, t in [0, 1], sRGB
+vec3 viridis(float t)
+{
+    const vec3 c0 = vec3(0.2777273272234177, 0.005407344544966578, 0.3340998053353061);
+    const vec3 c1 = vec3(0.1050930431085774, 1.404613529898575, 1.384590162594685);
+    const vec3 c2 = vec3(-0.3308618287255563, 0.214847559468213, 0.09509516302823659);
+    const vec3 c3 = vec3(-4.634230498983486, -5.799100973351585, -19.33244095627987);
+    const vec3 c4 = vec3(6.228269936347081, 14.17993336680509, 56.69055260068105);
+    const vec3 c5 = vec3(4.776384997670288, -13.74514537774601, -65.35303263337234);
+    const vec3 c6 = vec3(-5.435455855934631, 4.645852612178535, 26.3124352495832);
+    return c0 + t*(c1 + t*(c2 + t*(c3 + t*(c4 + t*(c5 + t*c6)))));
+}
+
 void main()
 {
     // Texel color fetching from texture sampler
@@ -25,15 +44,21 @@ void main()
     vec3 viewD = normalize(viewPos - fragPosition);
     vec3 specular = vec3(0.0);
 
-    // NOTE: Implement here your fragment shader code
+    vec4 diffuse;
+    if (colorMode == 0) diffuse = phaseColors[int(fragValue + 0.5)];
+    else {
+        float t = clamp((fragValue - valueRange.x)/max(valueRange.y - valueRange.x, 1e-20), 0.0, 1.0);
+        // to linear, so the gamma correction below gives back the colormap
+        diffuse = vec4(pow(viridis(t), vec3(2.2)), 1.0);
+    }
 
     vec3 light = vec3(1.0);
 
     float NdotL = max(dot(normal, light), 0.0);
     lightDot += NdotL;
 
-    finalColor = (texelColor*((colDiffuse + vec4(specular, 1.0))*vec4(lightDot, 1.0)));
-    finalColor += texelColor*(ambient/10.0)*colDiffuse;
+    finalColor = (texelColor*((diffuse + vec4(specular, 1.0))*vec4(lightDot, 1.0)));
+    finalColor += texelColor*(ambient/10.0)*diffuse;
 
     // Gamma correction
     finalColor = pow(finalColor, vec4(1.0/2.2));
@@ -0,0 +1,17 @@
+#version 330
+
+// Input vertex attributes (from vertex shader)
+in vec2 fragTexCoord;
+
+// Input uniform values
+uniform sampler2D texture0;
+uniform float scale;
+
+// Output fragment color
+out vec4 finalColor;
+
+// texture0 holds the sum of the sub-frames; scale is 1/their count
+void main()
+{
+    finalColor = vec4(texture(texture0, fragTexCoord).rgb*scale, 1.0);
+}
@@ -5,10 +5,11 @@ in vec3 vertexPosition;
 in vec2 vertexTexCoord;
 in vec3 vertexNormal;
 in vec4 vertexColor;
+in mat4 instanceTransform;
+in float instanceValue;
 
 // Input uniform values
 uniform mat4 mvp;
-uniform mat4 matModel;
 uniform mat4 matNormal;
 
 // Output vertex attributes (to fragment shader)
@@ -16,17 +17,19 @@ out vec3 fragPosition;
 out vec2 fragTexCoord;
 out vec4 fragColor;
 out vec3 fragNormal;
+flat out float fragValue;
 
 // NOTE: Add here your custom variables
 
 void main()
 {
     // Send vertex attributes to fragment shader
-    fragPosition = vec3(matModel*vec4(vertexPosition, 1.0));
+    fragPosition = vec3(instanceTransform*vec4(vertexPosition, 1.0));
     fragTexCoord = vertexTexCoord;
     fragColor = vertexColor;
     fragNormal = normalize(vec3(matNormal*vec4(vertexNormal, 1.0)));
+    fragValue = instanceValue;
 
     // Calculate final vertex position
-    gl_Position = mvp*vec4(vertexPosition, 1.0);
+    gl_Position = mvp*instanceTransform*vec4(vertexPosition, 1.0);
 }
@@ -0,0 +1,64 @@
+#include "taskgraph.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+int TaskGraph::add(std::function<void()> work) {
+    Task task;
+    task.work = work;
+    task.prerequisites = 0;
+    tasks.push_back(task);
+    return (int)tasks.size() - 1;
+}
+
+void TaskGraph::depend(int task, int prerequisite) {
+    tasks[prerequisite].successors.push_back(task);
+    tasks[task].prerequisites++;
+}
+
+void TaskGraph::clear() {
+    tasks.clear();
+}
+
+void TaskGraph::run() {
+    const int count = (int)tasks.size();
+    std::unique_ptr<std::atomic<int>[]> pending(new std::atomic<int>[count]);
+    std::vector<int> ready;
+    for (int t = 0; t < count; t++) {
+        pending[t].store(tasks[t].prerequisites, std::memory_order_relaxed);
+        if (tasks[t].prerequisites == 0) ready.push_back(t);
+    }
+
+    // ready is used as a stack so a thread tends to continue on the tasks it just unlocked
+    std::mutex readyLock;
+    std::atomic<int> finished(0);
+
+    #pragma omp parallel
+    {
+        while (finished.load(std::memory_order_acquire) < count) {
+            int task = -1;
+            {
+                std::lock_guard<std::mutex> lock(readyLock);
+                if (!ready.empty()) {
+                    task = ready.back();
+                    ready.pop_back();
+                }
+            }
+            if (task < 0) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            tasks[task].work();
+            for (int successor : tasks[task].successors) {
+                if (pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard<std::mutex> lock(readyLock);
+                    ready.push_back(successor);
+                }
+            }
+            finished.fetch_add(1, std::memory_order_release);
+        }
+    }
+}
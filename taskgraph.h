@@ -0,0 +1,26 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+// tasks with prerequisites, run on the OpenMP threads. A task starts as soon as
+// every task it depends on has finished, so there is no barrier between stages.
+class TaskGraph {
+public:
+    int add(std::function<void()> work);
+    void depend(int task, int prerequisite);
+
+    // returns once every task has run
+    void run();
+    void clear();
+
+    int size() const { return (int)tasks.size(); }
+
+private:
+    struct Task {
+        std::function<void()> work;
+        std::vector<int> successors;
+        int prerequisites;
+    };
+    std::vector<Task> tasks;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+
+// single producer, single consumer hand-off of the latest value without locks.
+// The producer fills writeBuffer() and publishes it; the consumer calls update()
+// and reads readBuffer(), which always holds the newest complete value.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : shared(1), writeIndex(0), readIndex(2) {}
+
+    T& writeBuffer() { return buffers[writeIndex]; }
+
+    void publish() {
+        writeIndex = shared.exchange(writeIndex | freshBit, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // true if a newer value was published since the last update
+    bool update() {
+        if (!(shared.load(std::memory_order_acquire) & freshBit)) return false;
+        readIndex = shared.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    const T& readBuffer() const { return buffers[readIndex]; }
+
+private:
+    static const int indexMask = 3;
+    static const int freshBit = 4;
+
+    T buffers[3];
+    std::atomic<int> shared;    // index of the middle buffer, plus freshBit once published
+    int writeIndex;
+    int readIndex;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+// accuracy checks with a known reference answer, used to weigh solver
+// configurations by error against cost
+enum Validation {
+    VALIDATION_HYDROSTATIC,  // settled pool, interior pressure gradient vs. dp/dy = -2*g*m
+    VALIDATION_DAM_BREAK,    // front speed after the gate opens vs. Ritter's 2*sqrt(g_eff*H)
+    VALIDATION_DROPLET,      // l=2 oscillation frequency vs. Rayleigh's sqrt(8*sigma/(rho*R^3))
+    VALIDATION_COUNT
+};
+
+struct ValidationResult {
+    Validation validation;
+    int particles;
+    int steps;          // taken, settling included
+    double seconds;     // time spent in updateParticles only
+    double measured;    // NAN if failure is set
+    double expected;
+    double error;       // |measured - expected|/|expected|
+    double tolerance;
+    int failedSteps;    // diagnostics.failedSteps after the run; any fails the check
+    const char* failure;    // why nothing was measured ("not settled", "no oscillation", ...), or nullptr
+    bool passed;
+};
+
+const char* validationName(Validation validation);
+bool parseValidation(const char* name, Validation* validation);
+
+int defaultValidationSteps(Validation validation);
+double defaultValidationTolerance(Validation validation);
+
+// sets up the validation scene in particles, runs it and measures it. steps caps
+// the settling and the measured run of the hydrostatic and dam checks each; the
+// droplet runs at least two of its expected periods.
+ValidationResult runValidation(Validation validation, int count, int steps, float deltaTime, unsigned int seed, double tolerance);
@@ -0,0 +1,168 @@
+#include "volume.h"
+
+#include "fluid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+
+// one entry per (block, particle) whose support overlaps the block
+static std::vector<std::pair<unsigned long long, int> > blockParticles;
+static std::vector<int> particleEntries;
+
+static const int voxelCoordBias = 1 << 20;
+
+static inline int floorDiv(int a, int b) {
+    return a >= 0 ? a/b : -((-a + b - 1)/b);
+}
+
+// 21 bits per block coordinate, z most significant so keys sort by z, y, x
+static inline unsigned long long voxelBlockKey(int bx, int by, int bz) {
+    const unsigned long long mask = (1ULL << 21) - 1;
+    return (((unsigned long long)(bz + voxelCoordBias) & mask) << 42) |
+           (((unsigned long long)(by + voxelCoordBias) & mask) << 21) |
+           ((unsigned long long)(bx + voxelCoordBias) & mask);
+}
+
+// the range of blocks holding voxel centers within radius of p
+static inline void blockRange(Vector3 p, float radius, float voxelSize, int lo[3], int hi[3]) {
+    const float c[3] = {p.x, p.y, p.z};
+    for (int a = 0; a < 3; a++) {
+        lo[a] = floorDiv((int)ceilf((c[a] - radius)/voxelSize - 0.5f), voxelBlockEdge);
+        hi[a] = floorDiv((int)floorf((c[a] + radius)/voxelSize - 0.5f), voxelBlockEdge);
+    }
+}
+
+void rasterizeParticles(VoxelVolume& volume, float voxelSize) {
+    const int numParticles = (int)particles.size();
+    const float h = sampleRadius, h2 = h*h;
+    volume.voxelSize = voxelSize;
+    volume.blocks.clear();
+
+    // non-finite particles would cover the whole key range; they are skipped
+    particleEntries.assign(numParticles + 1, 0);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < numParticles; i++) {
+        const Vector3 p = particles[i].position;
+        const float sum = p.x + p.y + p.z;
+        if (sum - sum != 0.0f) continue;
+        int lo[3], hi[3];
+        blockRange(p, h, voxelSize, lo, hi);
+        particleEntries[i + 1] = (hi[0] - lo[0] + 1)*(hi[1] - lo[1] + 1)*(hi[2] - lo[2] + 1);
+    }
+    for (int i = 0; i < numParticles; i++) particleEntries[i + 1] += particleEntries[i];
+
+    blockParticles.resize(particleEntries[numParticles]);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < numParticles; i++) {
+        if (particleEntries[i + 1] == particleEntries[i]) continue;
+        int lo[3], hi[3];
+        blockRange(particles[i].position, h, voxelSize, lo, hi);
+        int e = particleEntries[i];
+        for (int z = lo[2]; z <= hi[2]; z++) {
+            for (int y = lo[1]; y <= hi[1]; y++) {
+                for (int x = lo[0]; x <= hi[0]; x++) blockParticles[e++] = std::make_pair(voxelBlockKey(x, y, z), i);
+            }
+        }
+    }
+    std::sort(blockParticles.begin(), blockParticles.end());
+
+    std::vector<int> blockStart;
+    for (size_t e = 0; e < blockParticles.size(); e++) {
+        if (e == 0 || blockParticles[e].first != blockParticles[e - 1].first) blockStart.push_back((int)e);
+    }
+    const int blocks = (int)blockStart.size();
+    blockStart.push_back((int)blockParticles.size());
+    volume.blocks.resize(blocks);
+
+    // W(r) = W(0)*(1 - r^2/h^2)^3 for the poly6 kernel
+    const float w0 = W_poly6(Vector3Zero(), h);
+
+    #pragma omp parallel for schedule(dynamic, 4)
+    for (int b = 0; b < blocks; b++) {
+        VoxelBlock& block = volume.blocks[b];
+        const unsigned long long key = blockParticles[blockStart[b]].first;
+        const unsigned long long mask = (1ULL << 21) - 1;
+        block.origin[0] = ((int)(key & mask) - voxelCoordBias)*voxelBlockEdge;
+        block.origin[1] = ((int)((key >> 21) & mask) - voxelCoordBias)*voxelBlockEdge;
+        block.origin[2] = ((int)((key >> 42) & mask) - voxelCoordBias)*voxelBlockEdge;
+        std::fill(block.density, block.density + voxelBlockSize, 0.0f);
+        std::fill(block.velocity, block.velocity + voxelBlockSize, Vector3Zero());
+
+        for (int e = blockStart[b]; e < blockStart[b + 1]; e++) {
+            const Particle& particle = particles[blockParticles[e].second];
+            const float volumeWeight = particle.mass/particle.density;
+            // the particle's support clipped to this block, in block voxels
+            int lo[3], hi[3];
+            const float c[3] = {particle.position.x, particle.position.y, particle.position.z};
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::max((int)ceilf((c[a] - h)/voxelSize - 0.5f) - block.origin[a], 0);
+                hi[a] = std::min((int)floorf((c[a] + h)/voxelSize - 0.5f) - block.origin[a], voxelBlockEdge - 1);
+            }
+            for (int z = lo[2]; z <= hi[2]; z++) {
+                const float dz = (block.origin[2] + z + 0.5f)*voxelSize - c[2];
+                for (int y = lo[1]; y <= hi[1]; y++) {
+                    const float dy = (block.origin[1] + y + 0.5f)*voxelSize - c[1];
+                    for (int x = lo[0]; x <= hi[0]; x++) {
+                        const float dx = (block.origin[0] + x + 0.5f)*voxelSize - c[0];
+                        const float r2 = dx*dx + dy*dy + dz*dz;
+                        if (r2 > h2) continue;
+                        const float t = 1.0f - r2/h2;
+                        const float w = w0*t*t*t;
+                        const int v = (z*voxelBlockEdge + y)*voxelBlockEdge + x;
+                        block.density[v] += particle.mass*w;
+                        block.velocity[v] = Vector3Add(block.velocity[v], Vector3Scale(particle.velocity, volumeWeight*w));
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool writeVoxelVolume(const char* path, const VoxelVolume& volume, float threshold) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+
+    // masks first, so the block count is known before the header
+    const int blocks = (int)volume.blocks.size();
+    std::vector<uint64_t> masks((size_t)blocks*8, 0);
+    uint32_t written = 0;
+    for (int b = 0; b < blocks; b++) {
+        uint64_t* mask = &masks[(size_t)b*8];
+        for (int v = 0; v < voxelBlockSize; v++) {
+            if (volume.blocks[b].density[v] > threshold) mask[v >> 6] |= 1ULL << (v & 63);
+        }
+        written += (mask[0] | mask[1] | mask[2] | mask[3] | mask[4] | mask[5] | mask[6] | mask[7]) != 0;
+    }
+
+    const uint32_t version = 1;
+    fwrite("F65V", 1, 4, file);
+    fwrite(&version, sizeof(version), 1, file);
+    fwrite(&volume.voxelSize, sizeof(float), 1, file);
+    fwrite(&threshold, sizeof(float), 1, file);
+    fwrite(&written, sizeof(written), 1, file);
+
+    std::vector<float> values;
+    for (int b = 0; b < blocks; b++) {
+        const VoxelBlock& block = volume.blocks[b];
+        const uint64_t* mask = &masks[(size_t)b*8];
+        if ((mask[0] | mask[1] | mask[2] | mask[3] | mask[4] | mask[5] | mask[6] | mask[7]) == 0) continue;
+        values.clear();
+        for (int v = 0; v < voxelBlockSize; v++) {
+            if (mask[v >> 6] >> (v & 63) & 1) values.push_back(block.density[v]);
+        }
+        for (int v = 0; v < voxelBlockSize; v++) {
+            if (!(mask[v >> 6] >> (v & 63) & 1)) continue;
+            values.push_back(block.velocity[v].x);
+            values.push_back(block.velocity[v].y);
+            values.push_back(block.velocity[v].z);
+        }
+        const int32_t origin[3] = {block.origin[0], block.origin[1], block.origin[2]};
+        fwrite(origin, sizeof(int32_t), 3, file);
+        fwrite(mask, sizeof(uint64_t), 8, file);
+        fwrite(values.data(), sizeof(float), values.size(), file);
+    }
+    return fclose(file) == 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <raymath.h>
+#include <vector>
+
+// particle density and velocity splatted onto a sparse grid of voxels, in the
+// manner of a VDB tree's leaves: 8^3-voxel blocks exist only where a particle's
+// kernel reaches
+static const int voxelBlockEdge = 8;
+static const int voxelBlockSize = voxelBlockEdge*voxelBlockEdge*voxelBlockEdge;
+
+struct VoxelBlock {
+    int origin[3];                      // of voxel 0, in voxels, a multiple of voxelBlockEdge
+    float density[voxelBlockSize];      // x fastest, then y, then z
+    Vector3 velocity[voxelBlockSize];
+};
+
+// voxel (i, j, k) is centered at ((i, j, k) + 0.5)*voxelSize
+struct VoxelVolume {
+    float voxelSize;
+    std::vector<VoxelBlock> blocks;     // sorted by z, y, x of their origins
+};
+
+// density sum m W and velocity sum m/rho v W at every voxel center within
+// sampleRadius of a particle, W being the poly6 kernel. Each block is filled by
+// one thread from the particles whose support overlaps it, so no voxel is
+// written by two threads and no atomics are needed.
+void rasterizeParticles(VoxelVolume& volume, float voxelSize);
+
+// little-endian binary: "F65V", uint32 version (1), float voxelSize, float
+// threshold, uint32 block count, then per block int32 origin[3], a 512-bit mask
+// (uint64[8], bit v for voxel v) of the voxels whose density is above threshold,
+// and for those voxels only, in order, their densities then their velocities
+// (3 floats each). Blocks with no voxel above threshold are left out.
+bool writeVoxelVolume(const char* path, const VoxelVolume& volume, float threshold);